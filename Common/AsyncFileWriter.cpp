@@ -0,0 +1,159 @@
+#include "AsyncFileWriter.h"
+
+#include <ErrorHandling.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <set>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+#include <boost/log/trivial.hpp>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	double ToSeconds(std::chrono::steady_clock::duration duration)
+	{
+		return std::chrono::duration_cast<std::chrono::duration<double>>(duration).count();
+	}
+
+	// native handle, so file can be flushed before rename
+	void WriteNativeFile(const std::string& fileName, const uint8_t* data, size_t size, bool sync)
+	{
+#ifdef _WIN32
+		const auto file = CreateFileA(fileName.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		CHECK_EX(file != INVALID_HANDLE_VALUE, "Can't create file");
+		auto ok = true;
+		for (size_t written = 0; ok && written < size;)
+		{
+			DWORD chunk = 0;
+			ok = WriteFile(file, data + written, static_cast<DWORD>(std::min<size_t>(size - written, 1 << 30)), &chunk, nullptr) != FALSE;
+			written += chunk;
+		}
+		ok = ok && (!sync || FlushFileBuffers(file) != FALSE);
+		ok = CloseHandle(file) != FALSE && ok;
+		CHECK_EX(ok, "Can't write file");
+#else
+		const auto file = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		CHECK_EX(file >= 0, "Can't create file");
+		auto ok = true;
+		for (size_t written = 0; ok && written < size;)
+		{
+			const auto chunk = write(file, data + written, size - written);
+			ok = chunk > 0 || (chunk < 0 && errno == EINTR);
+			written += chunk > 0 ? static_cast<size_t>(chunk) : 0;
+		}
+		ok = ok && (!sync || fsync(file) == 0);
+		ok = close(file) == 0 && ok;
+		CHECK_EX(ok, "Can't write file");
+#endif
+	}
+
+	// flushes existing file or directory (POSIX only, so renames in it are durable)
+	void SyncNativeFile(const std::string& fileName, bool directory)
+	{
+#ifdef _WIN32
+		if (directory)
+		{
+			return;
+		}
+		const auto file = CreateFileA(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		CHECK_EX(file != INVALID_HANDLE_VALUE, "Can't open file for flush");
+		const auto ok = FlushFileBuffers(file) != FALSE;
+		CloseHandle(file);
+		CHECK_EX(ok, "Can't flush file");
+#else
+		const auto file = open(fileName.c_str(), (directory ? O_RDONLY | O_DIRECTORY : O_WRONLY) | O_CLOEXEC);
+		CHECK_EX(file >= 0, "Can't open file for flush");
+		const auto ok = fsync(file) == 0;
+		close(file);
+		CHECK_EX(ok, "Can't flush file");
+#endif
+	}
+} //namespace
+
+AsyncFileWriter::AsyncFileWriter(size_t threads, size_t queueDepth, SyncPolicy sync) :
+	sync_(sync),
+	startTime_(Clock::now()),
+	bytes_(0),
+	files_(0),
+	inFlight_(0),
+	writes_(0),
+	depthSum_(0),
+	maxDepth_(0),
+	pool_(threads, std::max<size_t>(1, queueDepth))
+{
+}
+
+void AsyncFileWriter::Write(const std::string& fileName, std::vector<uint8_t> data, const WrittenHandler& onWritten)
+{
+	const auto depth = ++inFlight_;
+	++writes_;
+	depthSum_ += depth;
+	maxDepth_ = std::max(maxDepth_, depth);
+
+	auto task = [this, fileName, onWritten](const std::vector<uint8_t>& data) {
+		try
+		{
+			const auto tempFileName = fileName + ".tmp";
+			WriteNativeFile(tempFileName, data.data(), data.size(), sync_ == SyncPolicy::EachFile);
+			// replaces existing file
+			boost::filesystem::rename(tempFileName, fileName);
+		}
+		catch (...)
+		{
+			--inFlight_;
+			throw;
+		}
+		--inFlight_;
+		bytes_ += data.size();
+		++files_;
+		if (sync_ == SyncPolicy::AtFinish)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			unsynced_.push_back(fileName);
+		}
+		if (onWritten)
+		{
+			onWritten(fileName, data);
+		}
+	};
+	pool_.Submit(std::bind(task, std::move(data)));
+}
+
+void AsyncFileWriter::Finish()
+{
+	pool_.Wait();
+
+	if (!unsynced_.empty())
+	{
+		std::set<std::string> directories;
+		for (const auto& fileName : unsynced_)
+		{
+			pool_.Submit([fileName]() { SyncNativeFile(fileName, false); });
+			directories.insert(boost::filesystem::absolute(fileName).parent_path().string());
+		}
+		pool_.Wait();
+		for (const auto& directory : directories)
+		{
+			pool_.Submit([directory]() { SyncNativeFile(directory, true); });
+		}
+		pool_.Wait();
+		unsynced_.clear();
+	}
+
+	const auto seconds = ToSeconds(Clock::now() - startTime_);
+	const auto megabytes = bytes_ / (1024.0 * 1024.0);
+	std::stringstream s;
+	s << std::fixed << std::setprecision(2) << "File writer: " << files_ << " files, " << megabytes << " MB, " <<
+		(seconds > 0 ? megabytes / seconds : 0.0) << " MB/s, queue depth average " <<
+		(writes_ > 0 ? static_cast<double>(depthSum_) / writes_ : 0.0) << " max " << maxDepth_;
+	BOOST_LOG_TRIVIAL(info) << s.str();
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "WorkerPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum class SyncPolicy
+{
+	// leave flushing to OS
+	None,
+	// each file is on disk before it's reported written
+	EachFile,
+	// files are flushed together by Finish, so storage latency is paid once per job
+	AtFinish
+};
+
+// Writes files on I/O threads with several files in flight, so storage latency (network shares) overlaps.
+// Each file is written to temporary file and renamed, so fileName never has partial content.
+class AsyncFileWriter
+{
+public:
+	using WrittenHandler = std::function<void(const std::string& fileName, const std::vector<uint8_t>& data)>;
+
+	AsyncFileWriter(size_t threads, size_t queueDepth, SyncPolicy sync);
+
+	// Called from one thread. Blocks while queue is full, rethrows failure of earlier write.
+	// onWritten is called on I/O thread after file is renamed (and flushed with EachFile).
+	void Write(const std::string& fileName, std::vector<uint8_t> data, const WrittenHandler& onWritten = WrittenHandler());
+	// Waits for queued writes, flushes files with AtFinish, logs throughput, rethrows first failure.
+	void Finish();
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	const SyncPolicy sync_;
+	const Clock::time_point startTime_;
+
+	std::atomic<uint64_t> bytes_;
+	std::atomic<uint64_t> files_;
+	std::atomic<uint32_t> inFlight_;
+	// queue depth sampled at each Write
+	uint64_t writes_;
+	uint64_t depthSum_;
+	uint32_t maxDepth_;
+
+	// files flushed by Finish with AtFinish
+	std::mutex mutex_;
+	std::vector<std::string> unsynced_;
+
+	// last, so queued writes finish before members they use are destroyed
+	WorkerPool pool_;
+};
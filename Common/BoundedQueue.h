@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// Multi-producer multi-consumer FIFO of limited capacity. Push blocks while queue is full,
+// Pop blocks while it is empty. After Close pending items are still popped, new ones are rejected.
+template <typename T>
+class BoundedQueue
+{
+public:
+	explicit BoundedQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1), closed_(false)
+	{
+	}
+
+	// returns false if queue was closed
+	bool Push(T item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		notFull_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+		if (closed_)
+		{
+			return false;
+		}
+
+		items_.push_back(std::move(item));
+		lock.unlock();
+		notEmpty_.notify_one();
+		return true;
+	}
+
+	// returns false when queue is closed and drained
+	bool Pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		notEmpty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+		if (items_.empty())
+		{
+			return false;
+		}
+
+		item = std::move(items_.front());
+		items_.pop_front();
+		lock.unlock();
+		notFull_.notify_one();
+		return true;
+	}
+
+	void Close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			closed_ = true;
+		}
+		notFull_.notify_all();
+		notEmpty_.notify_all();
+	}
+
+	size_t GetCapacity() const { return capacity_; }
+
+private:
+	const size_t capacity_;
+	bool closed_;
+	std::deque<T> items_;
+	std::mutex mutex_;
+	std::condition_variable notFull_;
+	std::condition_variable notEmpty_;
+};
@@ -0,0 +1,176 @@
+#include "Contours.h"
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+
+namespace
+{
+	const uint32_t TrianglesPerBin = 16;
+	const uint32_t MaxBins = 4096;
+
+	// same key for edge of both adjacent triangles
+	uint64_t GetEdgeKey(uint32_t a, uint32_t b)
+	{
+		return a < b ? (uint64_t(a) << 32 | b) : (uint64_t(b) << 32 | a);
+	}
+} //namespace
+
+MeshSlicer::MeshSlicer(const std::vector<float>& vb, const std::vector<uint32_t>& ib) :
+	vb_(vb),
+	ib_(ib),
+	min_(std::numeric_limits<float>::max()),
+	max_(std::numeric_limits<float>::lowest()),
+	binHeight_(0.0f)
+{
+	for (size_t i = 0; i + 2 < vb_.size(); i += 3)
+	{
+		const glm::vec3 v(vb_[i], vb_[i + 1], vb_[i + 2]);
+		min_ = glm::min(min_, v);
+		max_ = glm::max(max_, v);
+	}
+
+	const auto triangles = static_cast<uint32_t>(ib_.size() / 3);
+	bins_.resize(std::min(MaxBins, std::max(1u, triangles / TrianglesPerBin)));
+	binHeight_ = (max_.z - min_.z) / bins_.size();
+	for (uint32_t t = 0; t < triangles; ++t)
+	{
+		const auto z0 = vb_[3 * ib_[3 * t] + 2];
+		const auto z1 = vb_[3 * ib_[3 * t + 1] + 2];
+		const auto z2 = vb_[3 * ib_[3 * t + 2] + 2];
+		const auto last = GetBin(std::max({ z0, z1, z2 }));
+		for (auto bin = GetBin(std::min({ z0, z1, z2 })); bin <= last; ++bin)
+		{
+			bins_[bin].push_back(t);
+		}
+	}
+}
+
+uint32_t MeshSlicer::GetBin(float z) const
+{
+	if (!(binHeight_ > 0.0f))
+	{
+		return 0;
+	}
+	const auto bin = (z - min_.z) / binHeight_;
+	return static_cast<uint32_t>(std::min(std::max(bin, 0.0f), static_cast<float>(bins_.size() - 1)));
+}
+
+// computed from edge in fixed vertex order, so both triangles of edge get bitwise same point
+glm::vec2 MeshSlicer::Intersect(uint32_t a, uint32_t b, float z) const
+{
+	if (a > b)
+	{
+		std::swap(a, b);
+	}
+	const glm::vec3 va(vb_[3 * a], vb_[3 * a + 1], vb_[3 * a + 2]);
+	const glm::vec3 vb(vb_[3 * b], vb_[3 * b + 1], vb_[3 * b + 2]);
+	const auto t = (z - va.z) / (vb.z - va.z);
+	return glm::vec2(va) + (glm::vec2(vb) - glm::vec2(va)) * t;
+}
+
+std::vector<Contour> MeshSlicer::Slice(float z, uint32_t* openChains) const
+{
+	// vertex on plane counts as above it, so every crossed triangle has exactly two crossed edges
+	const auto isAbove = [this, z](uint32_t v) { return vb_[3 * v + 2] >= z; };
+
+	std::vector<Segment> segments;
+	for (auto t : bins_[GetBin(z)])
+	{
+		const uint32_t v[] = { ib_[3 * t], ib_[3 * t + 1], ib_[3 * t + 2] };
+		uint64_t downEdge = 0;
+		uint64_t upEdge = 0;
+		glm::vec2 downPoint;
+		auto crossings = 0;
+		for (auto i = 0; i < 3; ++i)
+		{
+			const auto a = v[i];
+			const auto b = v[(i + 1) % 3];
+			if (isAbove(a) == isAbove(b))
+			{
+				continue;
+			}
+			++crossings;
+			// with counter-clockwise faces solid is left of segment going from downward to upward edge
+			if (isAbove(a))
+			{
+				downEdge = GetEdgeKey(a, b);
+				downPoint = Intersect(a, b, z);
+			}
+			else
+			{
+				upEdge = GetEdgeKey(a, b);
+			}
+		}
+		if (crossings == 2)
+		{
+			Segment segment;
+			segment.startEdge = downEdge;
+			segment.endEdge = upEdge;
+			segment.start = downPoint;
+			segments.push_back(segment);
+		}
+	}
+
+	std::unordered_map<uint64_t, uint32_t> byStart;
+	byStart.reserve(segments.size());
+	for (uint32_t i = 0; i < segments.size(); ++i)
+	{
+		byStart.emplace(segments[i].startEdge, i);
+	}
+
+	std::vector<Contour> contours;
+	std::vector<bool> used(segments.size(), false);
+	uint32_t open = 0;
+	for (uint32_t first = 0; first < segments.size(); ++first)
+	{
+		if (used[first])
+		{
+			continue;
+		}
+		Contour contour;
+		auto closed = false;
+		for (auto i = first; ; )
+		{
+			used[i] = true;
+			// zero length segments of vertices on plane repeat points
+			if (contour.empty() || contour.back() != segments[i].start)
+			{
+				contour.push_back(segments[i].start);
+			}
+			const auto next = byStart.find(segments[i].endEdge);
+			if (next == byStart.end())
+			{
+				break;
+			}
+			if (next->second == first)
+			{
+				closed = true;
+				break;
+			}
+			if (used[next->second])
+			{
+				break;
+			}
+			i = next->second;
+		}
+		if (contour.size() > 1 && contour.front() == contour.back())
+		{
+			contour.pop_back();
+		}
+		if (!closed)
+		{
+			++open;
+		}
+		else if (contour.size() >= 3)
+		{
+			contours.push_back(std::move(contour));
+		}
+	}
+
+	if (openChains)
+	{
+		*openChains = open;
+	}
+	return contours;
+}
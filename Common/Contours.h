@@ -0,0 +1,43 @@
+#pragma once
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// closed polygon, last point connects to first
+using Contour = std::vector<glm::vec2>;
+
+// Cuts indexed triangle mesh with horizontal planes. Vertices must be merged, so neighbour triangles share edges.
+// vb and ib have to outlive it.
+// Contours around solid are counter-clockwise (seen from above), holes are clockwise.
+class MeshSlicer
+{
+public:
+	MeshSlicer(const std::vector<float>& vb, const std::vector<uint32_t>& ib);
+
+	// Thread-safe. Chains left open by non-manifold mesh are dropped and counted in openChains.
+	std::vector<Contour> Slice(float z, uint32_t* openChains = nullptr) const;
+
+	const glm::vec3& GetMin() const { return min_; }
+	const glm::vec3& GetMax() const { return max_; }
+
+private:
+	struct Segment
+	{
+		uint64_t startEdge;
+		uint64_t endEdge;
+		glm::vec2 start;
+	};
+
+	uint32_t GetBin(float z) const;
+	glm::vec2 Intersect(uint32_t a, uint32_t b, float z) const;
+
+	const std::vector<float>& vb_;
+	const std::vector<uint32_t>& ib_;
+	glm::vec3 min_;
+	glm::vec3 max_;
+	// triangles overlapping each of equal z ranges between min_.z and max_.z
+	std::vector<std::vector<uint32_t>> bins_;
+	float binHeight_;
+};
@@ -0,0 +1,159 @@
+#include "FramePool.h"
+
+#include <ErrorHandling.h>
+
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	const size_t PageSize = 4096;
+
+	uint8_t* AllocatePages(size_t size)
+	{
+#ifdef _MSC_VER
+		auto data = _aligned_malloc(size, PageSize);
+#else
+		void* data = nullptr;
+		if (posix_memalign(&data, PageSize, size) != 0)
+		{
+			data = nullptr;
+		}
+#endif
+		if (!data)
+		{
+			throw std::bad_alloc();
+		}
+		return static_cast<uint8_t*>(data);
+	}
+
+	void FreePages(uint8_t* data)
+	{
+#ifdef _MSC_VER
+		_aligned_free(data);
+#else
+		free(data);
+#endif
+	}
+} //namespace
+
+struct FrameBuffer::Storage
+{
+	explicit Storage(size_t frameSize) : frameSize(frameSize), allocatedCount(0)
+	{
+	}
+
+	~Storage()
+	{
+		for (auto data : freeFrames)
+		{
+			FreePages(data);
+		}
+	}
+
+	const size_t frameSize;
+	std::mutex mutex;
+	std::vector<uint8_t*> freeFrames;
+	size_t allocatedCount;
+};
+
+FrameBuffer::FrameBuffer() : data_(nullptr)
+{
+}
+
+FrameBuffer::FrameBuffer(const std::shared_ptr<Storage>& storage, uint8_t* data) : storage_(storage), data_(data)
+{
+}
+
+FrameBuffer::FrameBuffer(FrameBuffer&& other) : storage_(std::move(other.storage_)), data_(other.data_)
+{
+	other.data_ = nullptr;
+}
+
+FrameBuffer& FrameBuffer::operator=(FrameBuffer&& other)
+{
+	if (this != &other)
+	{
+		Release();
+		storage_ = std::move(other.storage_);
+		data_ = other.data_;
+		other.data_ = nullptr;
+	}
+	return *this;
+}
+
+FrameBuffer::~FrameBuffer()
+{
+	Release();
+}
+
+size_t FrameBuffer::GetSize() const
+{
+	return storage_ ? storage_->frameSize : 0;
+}
+
+void FrameBuffer::Release()
+{
+	if (!data_)
+	{
+		return;
+	}
+
+	{
+		// capacity is reserved on allocation, so returning frame never allocates
+		std::lock_guard<std::mutex> lock(storage_->mutex);
+		storage_->freeFrames.push_back(data_);
+	}
+	data_ = nullptr;
+	storage_.reset();
+}
+
+FramePool::FramePool(size_t frameSize, size_t preallocatedCount) :
+	storage_(std::make_shared<FrameBuffer::Storage>(frameSize))
+{
+	ASSERT(frameSize > 0);
+	storage_->freeFrames.reserve(preallocatedCount);
+	for (size_t i = 0; i < preallocatedCount; ++i)
+	{
+		storage_->freeFrames.push_back(AllocatePages(frameSize));
+		++storage_->allocatedCount;
+	}
+}
+
+FrameBuffer FramePool::Acquire()
+{
+	{
+		std::lock_guard<std::mutex> lock(storage_->mutex);
+		if (!storage_->freeFrames.empty())
+		{
+			const auto data = storage_->freeFrames.back();
+			storage_->freeFrames.pop_back();
+			return FrameBuffer(storage_, data);
+		}
+	}
+
+	auto data = AllocatePages(storage_->frameSize);
+	std::lock_guard<std::mutex> lock(storage_->mutex);
+	try
+	{
+		storage_->freeFrames.reserve(storage_->allocatedCount + 1);
+	}
+	catch (...)
+	{
+		FreePages(data);
+		throw;
+	}
+	++storage_->allocatedCount;
+	return FrameBuffer(storage_, data);
+}
+
+size_t FramePool::GetFrameSize() const
+{
+	return storage_->frameSize;
+}
+
+size_t FramePool::GetAllocatedCount() const
+{
+	std::lock_guard<std::mutex> lock(storage_->mutex);
+	return storage_->allocatedCount;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class FramePool;
+
+// Move-only handle to page-aligned pool buffer, returns it to pool when destroyed or released.
+// Handle may outlive pool object.
+class FrameBuffer
+{
+public:
+	FrameBuffer();
+	FrameBuffer(FrameBuffer&& other);
+	FrameBuffer& operator=(FrameBuffer&& other);
+	~FrameBuffer();
+
+	uint8_t* GetData() { return data_; }
+	const uint8_t* GetData() const { return data_; }
+	size_t GetSize() const;
+	bool IsValid() const { return data_ != nullptr; }
+
+	void Release();
+
+private:
+	friend class FramePool;
+	struct Storage;
+
+	FrameBuffer(const std::shared_ptr<Storage>& storage, uint8_t* data);
+	FrameBuffer(const FrameBuffer&) = delete;
+	FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+	std::shared_ptr<Storage> storage_;
+	uint8_t* data_;
+};
+
+// Recycles fixed size frame buffers, so steady-state frame processing does not allocate.
+// Pool grows when all frames are in use.
+class FramePool
+{
+public:
+	FramePool(size_t frameSize, size_t preallocatedCount = 0);
+
+	FrameBuffer Acquire();
+
+	size_t GetFrameSize() const;
+	// frames allocated since pool creation, stays constant in steady state
+	size_t GetAllocatedCount() const;
+
+private:
+	std::shared_ptr<FrameBuffer::Storage> storage_;
+};
@@ -0,0 +1,80 @@
+#include "Hash.h"
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+	// xxHash64 primes
+	const uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+	const uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+	const uint64_t Prime4 = 0x85EBCA77C2B2AE63ull;
+	const uint64_t Prime5 = 0x27D4EB2F165667C5ull;
+	const uint64_t Seed = 0;
+
+	uint64_t RotateLeft(uint64_t x, int bits)
+	{
+		return (x << bits) | (x >> (64 - bits));
+	}
+
+	// MurmurHash3 finalizer
+	uint64_t Mix(uint64_t h)
+	{
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+		return h;
+	}
+} //namespace
+
+Hasher::Hasher() : state_(Seed + Prime5), size_(0)
+{
+}
+
+void Hasher::Update(const void* data, size_t size)
+{
+	// result does not depend on how input is split between calls only if splits are at 8 byte boundaries
+	const auto bytes = static_cast<const uint8_t*>(data);
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		// rotation brings high bits of products down, so every input bit reaches every state bit
+		state_ ^= RotateLeft(word * Prime2, 31) * Prime1;
+		state_ = RotateLeft(state_, 27) * Prime1 + Prime4;
+	}
+	for (; i < size; ++i)
+	{
+		state_ ^= bytes[i] * Prime5;
+		state_ = RotateLeft(state_, 11) * Prime1;
+	}
+	size_ += size;
+}
+
+void Hasher::Update(const std::string& text)
+{
+	Update(text.data(), text.size());
+}
+
+uint64_t Hasher::Finish() const
+{
+	return Mix(state_ ^ size_);
+}
+
+uint64_t Hash64(const void* data, size_t size)
+{
+	Hasher hasher;
+	hasher.Update(data, size);
+	return hasher.Finish();
+}
+
+std::string FormatHash(uint64_t hash)
+{
+	std::stringstream s;
+	s << std::hex << std::setfill('0') << std::setw(16) << hash;
+	return s.str();
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Non-cryptographic 64-bit hash for change detection and cache keys, stable between runs and processes.
+// Single lane of xxHash64 over 8-byte words with final avalanche mix.
+class Hasher
+{
+public:
+	Hasher();
+
+	void Update(const void* data, size_t size);
+	void Update(const std::string& text);
+	uint64_t Finish() const;
+
+private:
+	uint64_t state_;
+	uint64_t size_;
+};
+
+uint64_t Hash64(const void* data, size_t size);
+std::string FormatHash(uint64_t hash);
@@ -0,0 +1,416 @@
+#include "LayerStack.h"
+
+#include <ErrorHandling.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <boost/filesystem.hpp>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LAYERSTACK_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+	const char Magic[8] = { 'Y', 'L', 'S', 'T', 'A', 'C', 'K', '\0' };
+	const char TrailerMagic[4] = { 'Y', 'L', 'S', 'I' };
+	const uint32_t Version = 2;
+	// version 1 has no keyframe interval
+	const size_t HeaderSizeV1 = sizeof(Magic) + 8 * 4;
+	const size_t HeaderSize = HeaderSizeV1 + 4;
+	const size_t IndexEntrySize = 2 * 8;
+	const size_t TrailerSize = 8 + 4 + sizeof(TrailerMagic);
+
+	int CountTrailingZeros(uint32_t v)
+	{
+#ifdef _MSC_VER
+		unsigned long index = 0;
+		_BitScanForward(&index, v);
+		return static_cast<int>(index);
+#else
+		return __builtin_ctz(v);
+#endif
+	}
+
+	// length of run of pixels equal to first one, at most size
+	size_t FindRunLength(const uint8_t* pixels, size_t size)
+	{
+		const auto value = pixels[0];
+		size_t length = 1;
+#ifdef LAYERSTACK_SSE2
+		const auto valueVector = _mm_set1_epi8(static_cast<char>(value));
+		for (; length + 16 <= size; length += 16)
+		{
+			const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + length));
+			const auto differ = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, valueVector))) & 0xFFFF;
+			if (differ != 0)
+			{
+				return length + CountTrailingZeros(differ);
+			}
+		}
+#endif
+		while (length < size && pixels[length] == value)
+		{
+			++length;
+		}
+		return length;
+	}
+
+	// reads (value, length) run at pos
+	void GetRun(const uint8_t* data, size_t size, size_t& pos, uint8_t& value, uint64_t& length)
+	{
+		CHECK_EX(pos < size, "Layer data is truncated");
+		value = data[pos++];
+		length = 0;
+		for (auto shift = 0; ; shift += 7)
+		{
+			CHECK_EX(pos < size && shift < 64, "Layer run length is malformed");
+			const auto byte = data[pos++];
+			length |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+			{
+				break;
+			}
+		}
+		CHECK_EX(length > 0, "Layer run is empty");
+	}
+
+	void PutVarint(std::vector<uint8_t>& out, uint64_t v)
+	{
+		while (v >= 0x80)
+		{
+			out.push_back(static_cast<uint8_t>(v | 0x80));
+			v >>= 7;
+		}
+		out.push_back(static_cast<uint8_t>(v));
+	}
+
+	template <typename T>
+	void PutLittleEndian(std::vector<uint8_t>& out, T v)
+	{
+		for (size_t i = 0; i < sizeof(T); ++i)
+		{
+			out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+		}
+	}
+
+	void PutFloat(std::vector<uint8_t>& out, float v)
+	{
+		uint32_t bits = 0;
+		std::memcpy(&bits, &v, sizeof(bits));
+		PutLittleEndian(out, bits);
+	}
+
+	template <typename T>
+	T GetLittleEndian(const uint8_t* data)
+	{
+		T v = 0;
+		for (size_t i = 0; i < sizeof(T); ++i)
+		{
+			v |= static_cast<T>(data[i]) << (8 * i);
+		}
+		return v;
+	}
+
+	float GetFloat(const uint8_t* data)
+	{
+		const auto bits = GetLittleEndian<uint32_t>(data);
+		float v = 0.0f;
+		std::memcpy(&v, &bits, sizeof(v));
+		return v;
+	}
+} //namespace
+
+void EncodeRleLayer(const uint8_t* raster, uint32_t width, uint32_t height, std::vector<uint8_t>& layer)
+{
+	layer.clear();
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		const auto row = raster + static_cast<size_t>(width) * y;
+		for (size_t x = 0; x < width;)
+		{
+			const auto length = FindRunLength(row + x, width - x);
+			layer.push_back(row[x]);
+			PutVarint(layer, length);
+			x += length;
+		}
+	}
+}
+
+void DecodeRleLayer(const uint8_t* layer, size_t size, uint32_t width, uint32_t height, std::vector<uint8_t>& raster)
+{
+	raster.resize(static_cast<size_t>(width) * height);
+	size_t pos = 0;
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		auto dst = &raster[static_cast<size_t>(width) * y];
+		for (size_t x = 0; x < width;)
+		{
+			uint8_t value = 0;
+			uint64_t length = 0;
+			GetRun(layer, size, pos, value, length);
+			CHECK_EX(length <= width - x, "Layer run crosses row end");
+			std::memset(dst + x, value, static_cast<size_t>(length));
+			x += static_cast<size_t>(length);
+		}
+	}
+	CHECK_EX(pos == size, "Layer data has trailing bytes");
+}
+
+void XorRleLayers(const std::vector<uint8_t>& previous, const std::vector<uint8_t>& current, uint32_t width, uint32_t height,
+	std::vector<uint8_t>& delta)
+{
+	delta.clear();
+	const auto pixels = static_cast<uint64_t>(width) * height;
+	size_t previousPos = 0;
+	size_t currentPos = 0;
+	uint8_t previousValue = 0;
+	uint8_t currentValue = 0;
+	uint64_t previousLeft = 0;
+	uint64_t currentLeft = 0;
+	// pending output run, extended while XOR stays same
+	uint8_t runValue = 0;
+	uint64_t runLength = 0;
+	uint64_t done = 0;
+	while (done < pixels)
+	{
+		if (previousLeft == 0)
+		{
+			GetRun(previous.data(), previous.size(), previousPos, previousValue, previousLeft);
+		}
+		if (currentLeft == 0)
+		{
+			GetRun(current.data(), current.size(), currentPos, currentValue, currentLeft);
+		}
+		const auto length = std::min(previousLeft, currentLeft);
+		const auto value = static_cast<uint8_t>(previousValue ^ currentValue);
+		if (runLength > 0 && value != runValue)
+		{
+			delta.push_back(runValue);
+			PutVarint(delta, runLength);
+			runLength = 0;
+		}
+		runValue = value;
+		runLength += length;
+		previousLeft -= length;
+		currentLeft -= length;
+		done += length;
+	}
+	CHECK_EX(done == pixels && previousLeft == 0 && currentLeft == 0 &&
+		previousPos == previous.size() && currentPos == current.size(), "Layer sizes differ");
+	if (runLength > 0)
+	{
+		delta.push_back(runValue);
+		PutVarint(delta, runLength);
+	}
+}
+
+void ApplyDeltaLayer(const uint8_t* delta, size_t size, uint32_t width, uint32_t height, std::vector<uint8_t>& raster)
+{
+	const auto pixels = static_cast<size_t>(width) * height;
+	CHECK_EX(raster.size() == pixels, "Delta layer has no previous layer");
+	size_t pos = 0;
+	for (size_t x = 0; x < pixels;)
+	{
+		uint8_t value = 0;
+		uint64_t length = 0;
+		GetRun(delta, size, pos, value, length);
+		CHECK_EX(length <= pixels - x, "Delta layer run crosses image end");
+		// zero runs are unchanged pixels
+		if (value != 0)
+		{
+			const auto dst = &raster[x];
+			for (size_t i = 0; i < length; ++i)
+			{
+				dst[i] ^= value;
+			}
+		}
+		x += static_cast<size_t>(length);
+	}
+	CHECK_EX(pos == size, "Layer data has trailing bytes");
+}
+
+LayerStackWriter::LayerStackWriter(const std::string& fileName, const LayerStackHeader& header) :
+	fileName_(fileName),
+	tempFileName_(fileName + ".tmp"),
+	header_(header),
+	file_(tempFileName_, std::ios::binary | std::ios::trunc),
+	offset_(0),
+	finished_(false)
+{
+	CHECK_EX(file_, "Can't create layer stack");
+	CHECK_EX(header.keyframeInterval > 0, "Keyframe interval must be positive");
+
+	std::vector<uint8_t> bytes(Magic, Magic + sizeof(Magic));
+	PutLittleEndian(bytes, Version);
+	PutLittleEndian(bytes, header.width);
+	PutLittleEndian(bytes, header.height);
+	PutFloat(bytes, header.step);
+	PutFloat(bytes, header.plateWidth);
+	PutFloat(bytes, header.plateHeight);
+	PutLittleEndian(bytes, header.baseLayers);
+	PutLittleEndian(bytes, header.imagesPerSlice);
+	PutLittleEndian(bytes, header.keyframeInterval);
+	Write(bytes.data(), bytes.size());
+}
+
+LayerStackWriter::~LayerStackWriter()
+{
+	if (!finished_)
+	{
+		file_.close();
+		boost::system::error_code error;
+		boost::filesystem::remove(tempFileName_, error);
+	}
+}
+
+void LayerStackWriter::Add(const std::vector<uint8_t>& layer)
+{
+	CHECK_EX(!finished_, "Layer stack is finished");
+	const auto keyframe = (index_.size() / 2) % header_.keyframeInterval == 0;
+	index_.push_back(offset_);
+	if (keyframe)
+	{
+		index_.push_back(layer.size());
+		Write(layer.data(), layer.size());
+	}
+	else
+	{
+		XorRleLayers(previous_, layer, header_.width, header_.height, delta_);
+		index_.push_back(delta_.size());
+		Write(delta_.data(), delta_.size());
+	}
+	if (header_.keyframeInterval > 1)
+	{
+		previous_ = layer;
+	}
+}
+
+void LayerStackWriter::Finish()
+{
+	CHECK_EX(!finished_, "Layer stack is finished");
+	CHECK_EX(index_.size() / 2 <= std::numeric_limits<uint32_t>::max(), "Too many layers");
+
+	const auto indexOffset = offset_;
+	std::vector<uint8_t> bytes;
+	for (auto v : index_)
+	{
+		PutLittleEndian(bytes, v);
+	}
+	PutLittleEndian(bytes, indexOffset);
+	PutLittleEndian(bytes, static_cast<uint32_t>(index_.size() / 2));
+	bytes.insert(bytes.end(), TrailerMagic, TrailerMagic + sizeof(TrailerMagic));
+	Write(bytes.data(), bytes.size());
+
+	file_.close();
+	CHECK_EX(file_, "Can't write layer stack");
+	// replaces existing stack
+	boost::filesystem::rename(tempFileName_, fileName_);
+	finished_ = true;
+}
+
+void LayerStackWriter::Write(const void* data, size_t size)
+{
+	file_.write(static_cast<const char*>(data), size);
+	CHECK_EX(file_, "Can't write layer stack");
+	offset_ += size;
+}
+
+LayerStackReader::LayerStackReader(const std::string& fileName) :
+	file_(fileName, std::ios::binary),
+	nextLayer_(0)
+{
+	CHECK_EX(file_, "Can't open layer stack");
+
+	uint8_t header[HeaderSize] = {};
+	file_.read(reinterpret_cast<char*>(header), HeaderSizeV1);
+	CHECK_EX(file_ && std::memcmp(header, Magic, sizeof(Magic)) == 0, "File is not layer stack");
+	const auto version = GetLittleEndian<uint32_t>(header + 8);
+	CHECK_EX(version == 1 || version == Version, "Unsupported layer stack version");
+	header_.width = GetLittleEndian<uint32_t>(header + 12);
+	header_.height = GetLittleEndian<uint32_t>(header + 16);
+	header_.step = GetFloat(header + 20);
+	header_.plateWidth = GetFloat(header + 24);
+	header_.plateHeight = GetFloat(header + 28);
+	header_.baseLayers = GetLittleEndian<uint32_t>(header + 32);
+	header_.imagesPerSlice = GetLittleEndian<uint32_t>(header + 36);
+	const auto headerSize = version == 1 ? HeaderSizeV1 : HeaderSize;
+	if (version != 1)
+	{
+		file_.read(reinterpret_cast<char*>(header + HeaderSizeV1), HeaderSize - HeaderSizeV1);
+		CHECK_EX(file_, "Layer stack header is truncated");
+		header_.keyframeInterval = GetLittleEndian<uint32_t>(header + 40);
+		CHECK_EX(header_.keyframeInterval > 0, "Layer stack header is corrupted");
+	}
+
+	uint8_t trailer[TrailerSize];
+	file_.seekg(-static_cast<std::streamoff>(sizeof(trailer)), std::ios::end);
+	file_.read(reinterpret_cast<char*>(trailer), sizeof(trailer));
+	CHECK_EX(file_ && std::memcmp(trailer + 12, TrailerMagic, sizeof(TrailerMagic)) == 0, "Layer stack is incomplete");
+	const auto indexOffset = GetLittleEndian<uint64_t>(trailer);
+	const auto layerCount = GetLittleEndian<uint32_t>(trailer + 8);
+
+	// whole index is read once, layers are then read with single seek
+	std::vector<uint8_t> index(static_cast<size_t>(layerCount) * IndexEntrySize);
+	file_.seekg(static_cast<std::streamoff>(indexOffset));
+	file_.read(reinterpret_cast<char*>(index.data()), index.size());
+	CHECK_EX(file_, "Can't read layer stack index");
+	index_.resize(layerCount);
+	for (size_t i = 0; i < index_.size(); ++i)
+	{
+		auto& entry = index_[i];
+		entry.offset = GetLittleEndian<uint64_t>(&index[i * IndexEntrySize]);
+		entry.size = GetLittleEndian<uint64_t>(&index[i * IndexEntrySize + 8]);
+		CHECK_EX(entry.offset >= headerSize && entry.offset <= indexOffset && entry.size <= indexOffset - entry.offset,
+			"Layer stack index is corrupted");
+	}
+}
+
+void LayerStackReader::ReadLayer(uint32_t layer, std::vector<uint8_t>& raster)
+{
+	CHECK_EX(layer < index_.size(), "Layer index is out of range");
+	for (auto i = layer - layer % header_.keyframeInterval; i <= layer; ++i)
+	{
+		DecodeLayer(i, raster);
+	}
+	nextLayer_ = layer + 1;
+}
+
+bool LayerStackReader::ReadNext(std::vector<uint8_t>& raster)
+{
+	if (nextLayer_ >= index_.size())
+	{
+		return false;
+	}
+	DecodeLayer(nextLayer_++, raster);
+	return true;
+}
+
+bool LayerStackReader::IsKeyframe(uint32_t layer) const
+{
+	return layer % header_.keyframeInterval == 0;
+}
+
+void LayerStackReader::DecodeLayer(uint32_t layer, std::vector<uint8_t>& raster)
+{
+	const auto& entry = index_[layer];
+	data_.resize(static_cast<size_t>(entry.size));
+	file_.seekg(static_cast<std::streamoff>(entry.offset));
+	file_.read(reinterpret_cast<char*>(data_.data()), data_.size());
+	CHECK_EX(file_, "Can't read layer");
+	if (IsKeyframe(layer))
+	{
+		DecodeRleLayer(data_.data(), data_.size(), header_.width, header_.height, raster);
+	}
+	else
+	{
+		ApplyDeltaLayer(data_.data(), data_.size(), header_.width, header_.height, raster);
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Layer stack file: all layer images of job in one file for printer controllers without PNG decoder.
+// Little-endian layout:
+//   header:  "YLSTACK\0", version, width, height, step (mm, float), plate width, plate height (mm, float),
+//            base (white) layers, images per slice (2 with ERM), keyframe interval (version 2)
+//   layers:  RLE data of each layer in output order
+//   index:   offset (uint64) and size (uint64) of each layer
+//   trailer: index offset (uint64), layer count (uint32), "YLSI"
+// Keyframe layer is rows top to bottom, row is runs of (value byte, LEB128 run length), runs don't cross rows.
+// Every layer whose number is multiple of keyframe interval is keyframe, other layers are deltas:
+// runs of layer XOR previous layer over whole image in row order, so unchanged rows merge into one zero run.
+struct LayerStackHeader
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	float step = 0.0f;
+	float plateWidth = 0.0f;
+	float plateHeight = 0.0f;
+	uint32_t baseLayers = 0;
+	uint32_t imagesPerSlice = 1;
+	// 1 stores every layer in full
+	uint32_t keyframeInterval = 1;
+};
+
+void EncodeRleLayer(const uint8_t* raster, uint32_t width, uint32_t height, std::vector<uint8_t>& layer);
+// Reference decoder, throws on malformed data.
+void DecodeRleLayer(const uint8_t* layer, size_t size, uint32_t width, uint32_t height, std::vector<uint8_t>& raster);
+// Delta from previous to current layer (both in keyframe format), computed from runs without decoding pixels.
+void XorRleLayers(const std::vector<uint8_t>& previous, const std::vector<uint8_t>& current, uint32_t width, uint32_t height,
+	std::vector<uint8_t>& delta);
+// XORs delta layer into raster of previous layer, throws on malformed data.
+void ApplyDeltaLayer(const uint8_t* delta, size_t size, uint32_t width, uint32_t height, std::vector<uint8_t>& raster);
+
+// Layers are added in keyframe format and output order, layers between keyframes are stored as deltas.
+// Index is written by Finish.
+// Stack is written to temporary file and renamed by Finish, so fileName never has partial stack.
+class LayerStackWriter
+{
+public:
+	LayerStackWriter(const std::string& fileName, const LayerStackHeader& header);
+	// removes unfinished stack
+	~LayerStackWriter();
+
+	void Add(const std::vector<uint8_t>& layer);
+	void Finish();
+
+	const LayerStackHeader& GetHeader() const { return header_; }
+
+private:
+	void Write(const void* data, size_t size);
+
+	const std::string fileName_;
+	const std::string tempFileName_;
+	const LayerStackHeader header_;
+	std::ofstream file_;
+	uint64_t offset_;
+	std::vector<uint64_t> index_;
+	// last added layer, base of next delta
+	std::vector<uint8_t> previous_;
+	std::vector<uint8_t> delta_;
+	bool finished_;
+};
+
+// Reads any layer by decoding preceding keyframe and deltas after it.
+// Playback reads layers sequentially with ReadNext, which applies one delta per layer.
+class LayerStackReader
+{
+public:
+	explicit LayerStackReader(const std::string& fileName);
+
+	const LayerStackHeader& GetHeader() const { return header_; }
+	uint32_t GetLayerCount() const { return static_cast<uint32_t>(index_.size()); }
+	// ReadNext continues after this layer
+	void ReadLayer(uint32_t layer, std::vector<uint8_t>& raster);
+	// Decodes layer after one returned by previous call (first layer at start), false after last layer.
+	// raster must keep previous layer between calls.
+	bool ReadNext(std::vector<uint8_t>& raster);
+
+private:
+	struct IndexEntry
+	{
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	bool IsKeyframe(uint32_t layer) const;
+	void DecodeLayer(uint32_t layer, std::vector<uint8_t>& raster);
+
+	std::ifstream file_;
+	LayerStackHeader header_;
+	std::vector<IndexEntry> index_;
+	uint32_t nextLayer_;
+	std::vector<uint8_t> data_;
+};
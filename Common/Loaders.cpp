@@ -219,15 +219,9 @@ FileType GetFileType(const std::string& file)
 	return FileType::Unknown;
 }
 
-void LoadModel(const std::string& file, const std::function<void(
-	const std::vector<float>&, const std::vector<float>&, const std::vector<uint16_t>&)>& onMesh)
+void LoadMesh(const std::string& file, std::vector<float>& vb, std::vector<uint32_t>& ib)
 {
-	const auto fileType = GetFileType(file);
-
-	std::vector<float> vb;
-	std::vector<uint32_t> ib;
-
-	switch (fileType)
+	switch (GetFileType(file))
 	{
 	case FileType::Stl:
 		LoadStl(file, vb, ib);
@@ -238,6 +232,14 @@ void LoadModel(const std::string& file, const std::function<void(
 	default:
 		throw std::runtime_error("Unknown model file format");
 	}
+}
+
+void LoadModel(const std::string& file, const std::function<void(
+	const std::vector<float>&, const std::vector<float>&, const std::vector<uint16_t>&)>& onMesh)
+{
+	std::vector<float> vb;
+	std::vector<uint32_t> ib;
+	LoadMesh(file, vb, ib);
 
 	auto nb = CalculateNormals(vb, ib);
 
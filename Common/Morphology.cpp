@@ -0,0 +1,306 @@
+#include "Morphology.h"
+#include "Raster.h"
+
+#include <ErrorHandling.h>
+
+#include <algorithm>
+#include <future>
+#include <limits>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MORPHOLOGY_SSE2
+#endif
+
+namespace
+{
+	struct MaxOp
+	{
+		static const uint8_t Neutral = 0;
+		static uint8_t Apply(uint8_t a, uint8_t b) { return std::max(a, b); }
+#ifdef MORPHOLOGY_SSE2
+		static __m128i Apply(__m128i a, __m128i b) { return _mm_max_epu8(a, b); }
+#endif
+	};
+
+	struct MinOp
+	{
+		static const uint8_t Neutral = 0xFF;
+		static uint8_t Apply(uint8_t a, uint8_t b) { return std::min(a, b); }
+#ifdef MORPHOLOGY_SSE2
+		static __m128i Apply(__m128i a, __m128i b) { return _mm_min_epu8(a, b); }
+#endif
+	};
+
+	// Splits [0, count) into stripes processed concurrently, action(begin, end).
+	template <typename Action>
+	void ForEachStripe(int count, const Action& action)
+	{
+		const auto MinStripeSize = 16;
+		const auto threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+		const auto stripes = std::max(1, std::min(threads, count / MinStripeSize));
+
+		std::vector<std::future<void>> results;
+		for (auto i = 1; i < stripes; ++i)
+		{
+			const auto begin = count * i / stripes;
+			const auto end = count * (i + 1) / stripes;
+			results.push_back(std::async(std::launch::async, [&action, begin, end]() { action(begin, end); }));
+		}
+		action(0, count / stripes);
+
+		for (auto& v : results)
+		{
+			v.get();
+		}
+	}
+
+	template <typename Op>
+	void CombineRows(uint8_t* dst, const uint8_t* a, const uint8_t* b, size_t count)
+	{
+		size_t i = 0;
+#ifdef MORPHOLOGY_SSE2
+		const size_t VectorSize = sizeof(__m128i);
+		for (; i + VectorSize <= count; i += VectorSize)
+		{
+			const auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+			const auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), Op::Apply(va, vb));
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			dst[i] = Op::Apply(a[i], b[i]);
+		}
+	}
+
+	// 1D van Herk/Gil-Werman filter along columns [xBegin, xEnd), whole rows are combined at once
+	// so inner loops run over contiguous memory.
+	template <typename Op>
+	void FilterColumns(const uint8_t* src, uint8_t* dst, int width, int height, int xBegin, int xEnd, int radius)
+	{
+		const auto window = 2 * radius + 1;
+		const auto extendedHeight = (height + 2 * radius + window - 1) / window * window;
+		const auto stripeWidth = static_cast<size_t>(xEnd - xBegin);
+
+		const uint8_t neutral = Op::Neutral;
+		const std::vector<uint8_t> neutralRow(stripeWidth, neutral);
+		const auto extendedRow = [&](int e) {
+			const auto y = e - radius;
+			return y >= 0 && y < height ? src + static_cast<size_t>(y) * width + xBegin : neutralRow.data();
+		};
+
+		std::vector<uint8_t> prefix(extendedHeight * stripeWidth);
+		std::vector<uint8_t> suffix(extendedHeight * stripeWidth);
+		const auto prefixRow = [&](int e) { return &prefix[e * stripeWidth]; };
+		const auto suffixRow = [&](int e) { return &suffix[e * stripeWidth]; };
+
+		for (auto blockBegin = 0; blockBegin < extendedHeight; blockBegin += window)
+		{
+			const auto blockEnd = blockBegin + window;
+
+			std::copy(extendedRow(blockBegin), extendedRow(blockBegin) + stripeWidth, prefixRow(blockBegin));
+			for (auto e = blockBegin + 1; e < blockEnd; ++e)
+			{
+				CombineRows<Op>(prefixRow(e), prefixRow(e - 1), extendedRow(e), stripeWidth);
+			}
+
+			std::copy(extendedRow(blockEnd - 1), extendedRow(blockEnd - 1) + stripeWidth, suffixRow(blockEnd - 1));
+			for (auto e = blockEnd - 2; e >= blockBegin; --e)
+			{
+				CombineRows<Op>(suffixRow(e), suffixRow(e + 1), extendedRow(e), stripeWidth);
+			}
+		}
+
+		for (auto y = 0; y < height; ++y)
+		{
+			CombineRows<Op>(dst + static_cast<size_t>(y) * width + xBegin, suffixRow(y), prefixRow(y + window - 1), stripeWidth);
+		}
+	}
+
+	template <typename Op>
+	void FilterColumns(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height, int radius)
+	{
+		ForEachStripe(width, [&](int xBegin, int xEnd) {
+			FilterColumns<Op>(in.data(), out.data(), width, height, xBegin, xEnd, radius);
+		});
+	}
+
+	void Transpose(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height)
+	{
+		const auto TileSize = 64;
+		const auto tileRows = (height + TileSize - 1) / TileSize;
+		ForEachStripe(tileRows, [&](int tileBegin, int tileEnd) {
+			for (auto yTile = tileBegin * TileSize; yTile < std::min(height, tileEnd * TileSize); yTile += TileSize)
+			{
+				for (auto xTile = 0; xTile < width; xTile += TileSize)
+				{
+					ForEachPixel(std::make_pair(xTile, std::min(width, xTile + TileSize)),
+						std::make_pair(yTile, std::min(height, yTile + TileSize)), [&](int x, int y) {
+						out[static_cast<size_t>(x) * height + y] = in[static_cast<size_t>(y) * width + x];
+					});
+				}
+			}
+		});
+	}
+
+	template <typename Op>
+	void SquareFilter(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height, int radius)
+	{
+		ASSERT(in.size() == static_cast<size_t>(width) * height);
+		out.resize(in.size());
+		if (radius <= 0)
+		{
+			std::copy(in.begin(), in.end(), out.begin());
+			return;
+		}
+
+		// horizontal pass runs as vertical one on transposed image
+		std::vector<uint8_t> transposed(in.size());
+		std::vector<uint8_t> filtered(in.size());
+		Transpose(in, transposed, width, height);
+		FilterColumns<Op>(transposed, filtered, height, width, radius);
+		Transpose(filtered, transposed, height, width);
+		FilterColumns<Op>(transposed, out, width, height, radius);
+	}
+
+	// Felzenszwalb-Huttenlocher lower envelope of parabolas, sites with infinite value are skipped.
+	void DistanceTransformRow(const float* f, float* d, int count, std::vector<int>& v, std::vector<float>& z)
+	{
+		const auto Infinity = std::numeric_limits<float>::max();
+		const auto intersection = [f](int p, int q) {
+			return ((f[q] + static_cast<float>(q) * q) - (f[p] + static_cast<float>(p) * p)) / (2.0f * (q - p));
+		};
+
+		v.resize(count);
+		z.resize(count + 1);
+
+		auto k = -1;
+		for (auto q = 0; q < count; ++q)
+		{
+			if (f[q] == Infinity)
+			{
+				continue;
+			}
+
+			auto s = -Infinity;
+			while (k >= 0 && (s = intersection(v[k], q)) <= z[k])
+			{
+				--k;
+			}
+			if (k < 0)
+			{
+				s = -Infinity;
+			}
+			++k;
+			v[k] = q;
+			z[k] = s;
+			z[k + 1] = Infinity;
+		}
+
+		if (k < 0)
+		{
+			std::fill(d, d + count, Infinity);
+			return;
+		}
+
+		auto j = 0;
+		for (auto q = 0; q < count; ++q)
+		{
+			while (z[j + 1] < q)
+			{
+				++j;
+			}
+			const auto dx = static_cast<float>(q - v[j]);
+			d[q] = dx * dx + f[v[j]];
+		}
+	}
+} //namespace
+
+void DilateSquare(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height, int radius)
+{
+	SquareFilter<MaxOp>(in, out, width, height, radius);
+}
+
+void ErodeSquare(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height, int radius)
+{
+	SquareFilter<MinOp>(in, out, width, height, radius);
+}
+
+std::vector<float> DistanceTransform(const std::vector<uint8_t>& in, int width, int height, uint8_t threshold)
+{
+	ASSERT(in.size() == static_cast<size_t>(width) * height);
+	const auto Infinity = std::numeric_limits<float>::max();
+	const auto NoSite = std::numeric_limits<uint32_t>::max();
+
+	// vertical distances, rows are processed in order so inner loops vectorize across x
+	std::vector<uint32_t> columnDistance(in.size());
+	ForEachStripe(width, [&](int xBegin, int xEnd) {
+		for (auto y = 0; y < height; ++y)
+		{
+			const auto row = static_cast<size_t>(y) * width;
+			for (auto x = xBegin; x < xEnd; ++x)
+			{
+				const auto above = y > 0 ? columnDistance[row - width + x] : NoSite;
+				columnDistance[row + x] = in[row + x] >= threshold ? 0 : (above == NoSite ? NoSite : above + 1);
+			}
+		}
+		for (auto y = height - 2; y >= 0; --y)
+		{
+			const auto row = static_cast<size_t>(y) * width;
+			for (auto x = xBegin; x < xEnd; ++x)
+			{
+				const auto below = columnDistance[row + width + x];
+				if (below != NoSite)
+				{
+					columnDistance[row + x] = std::min(columnDistance[row + x], below + 1);
+				}
+			}
+		}
+	});
+
+	std::vector<float> result(in.size());
+	ForEachStripe(height, [&](int yBegin, int yEnd) {
+		std::vector<float> f(width);
+		std::vector<int> v;
+		std::vector<float> z;
+		for (auto y = yBegin; y < yEnd; ++y)
+		{
+			const auto row = static_cast<size_t>(y) * width;
+			std::transform(&columnDistance[row], &columnDistance[row] + width, f.begin(), [NoSite, Infinity](uint32_t d) {
+				return d == NoSite ? Infinity : static_cast<float>(d) * d;
+			});
+			DistanceTransformRow(f.data(), &result[row], width, v, z);
+		}
+	});
+
+	return result;
+}
+
+void DilateRound(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height, float radius, uint8_t threshold)
+{
+	const auto distance = DistanceTransform(in, width, height, threshold);
+	const auto radiusSquared = radius * radius;
+
+	out.resize(in.size());
+	std::transform(distance.begin(), distance.end(), out.begin(), [radiusSquared](float d) {
+		return static_cast<uint8_t>(d <= radiusSquared ? 0xFF : 0);
+	});
+}
+
+void ErodeRound(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height, float radius, uint8_t threshold)
+{
+	std::vector<uint8_t> background(in.size());
+	std::transform(in.begin(), in.end(), background.begin(), [threshold](uint8_t v) {
+		return static_cast<uint8_t>(v >= threshold ? 0 : 0xFF);
+	});
+
+	const auto distance = DistanceTransform(background, width, height);
+	const auto radiusSquared = radius * radius;
+
+	out.resize(in.size());
+	std::transform(distance.begin(), distance.end(), out.begin(), [radiusSquared](float d) {
+		return static_cast<uint8_t>(d > radiusSquared ? 0xFF : 0);
+	});
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Grayscale max/min over (2*radius+1)^2 square window, constant time per pixel
+// (van Herk/Gil-Werman). Window is clipped at image borders.
+void DilateSquare(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height, int radius);
+void ErodeSquare(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height, int radius);
+
+// Squared euclidean distance from each pixel to the nearest pixel >= threshold (exact, linear time).
+// Pixels with no such pixel in image get std::numeric_limits<float>::max().
+std::vector<float> DistanceTransform(const std::vector<uint8_t>& in, int width, int height, uint8_t threshold = 1);
+
+// Binary morphology with round kernel: pixels >= threshold are foreground, result is 0 or 255.
+void DilateRound(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height, float radius, uint8_t threshold = 1);
+void ErodeRound(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height, float radius, uint8_t threshold = 1);
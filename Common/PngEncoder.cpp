@@ -0,0 +1,228 @@
+#include "PngEncoder.h"
+#include "WorkerPool.h"
+
+#include <ErrorHandling.h>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+
+namespace
+{
+	// raw bytes per band, large enough that band boundaries don't cost compression
+	const size_t BandBytes = 512 * 1024;
+	const int CompressionLevel = 1;
+
+	struct Band
+	{
+		uint32_t firstRow = 0;
+		uint32_t rows = 0;
+		std::vector<uint8_t> deflated;
+		uLong adler = 1;
+		uLong crc = 0;
+		std::exception_ptr error;
+	};
+
+	void PutUInt32(std::vector<uint8_t>& out, uint32_t v)
+	{
+		const uint8_t bytes[] = {
+			static_cast<uint8_t>(v >> 24), static_cast<uint8_t>(v >> 16), static_cast<uint8_t>(v >> 8), static_cast<uint8_t>(v) };
+		out.insert(out.end(), bytes, bytes + sizeof(bytes));
+	}
+
+	void PutChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+	{
+		PutUInt32(out, static_cast<uint32_t>(data.size()));
+		const auto typeStart = out.size();
+		out.insert(out.end(), type, type + 4);
+		out.insert(out.end(), data.begin(), data.end());
+		PutUInt32(out, static_cast<uint32_t>(crc32(0, &out[typeStart], static_cast<uInt>(out.size() - typeStart))));
+	}
+
+	// filter type byte (none) before each row, band is ended by sync flush or by stream end for last one
+	void DeflateBand(Band& band, const uint8_t* pixData, size_t rowBytes, bool last)
+	{
+		z_stream stream = {};
+		// raw deflate, zlib header and checksum are written for whole image
+		CHECK_EX(deflateInit2(&stream, CompressionLevel, Z_DEFLATED, -15, 8, Z_RLE) == Z_OK, "Can't initialize deflate");
+		const auto rawSize = (rowBytes + 1) * band.rows;
+		// sync flush marker is few bytes more than bound of finished stream
+		band.deflated.resize(deflateBound(&stream, static_cast<uLong>(rawSize)) + 16);
+		stream.next_out = band.deflated.data();
+		stream.avail_out = static_cast<uInt>(band.deflated.size());
+
+		auto result = Z_OK;
+		Bytef filterType = 0;
+		for (uint32_t i = 0; i < band.rows && result == Z_OK; ++i)
+		{
+			const auto row = const_cast<Bytef*>(pixData + rowBytes * (band.firstRow + i));
+			band.adler = adler32(band.adler, &filterType, 1);
+			band.adler = adler32(band.adler, row, static_cast<uInt>(rowBytes));
+
+			stream.next_in = &filterType;
+			stream.avail_in = 1;
+			result = deflate(&stream, Z_NO_FLUSH);
+			stream.next_in = row;
+			stream.avail_in = static_cast<uInt>(rowBytes);
+			result = result == Z_OK ? deflate(&stream, Z_NO_FLUSH) : result;
+		}
+		if (result == Z_OK)
+		{
+			result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+		}
+		const auto size = band.deflated.size() - stream.avail_out;
+		deflateEnd(&stream);
+		CHECK_EX(result == (last ? Z_STREAM_END : Z_OK) && stream.avail_in == 0, "Deflate of PNG band failed");
+
+		band.deflated.resize(size);
+		band.crc = crc32(0, band.deflated.data(), static_cast<uInt>(band.deflated.size()));
+	}
+
+	// shared with pool tasks, which may start after image is done and then find no band left
+	struct BandJob
+	{
+		std::vector<Band> bands;
+		const uint8_t* pixData = nullptr;
+		size_t rowBytes = 0;
+		std::atomic<size_t> nextBand{ 0 };
+		std::mutex mutex;
+		std::condition_variable finished;
+		size_t doneBands = 0;
+	};
+
+	void DeflateBands(BandJob& job)
+	{
+		for (auto i = job.nextBand++; i < job.bands.size(); i = job.nextBand++)
+		{
+			try
+			{
+				DeflateBand(job.bands[i], job.pixData, job.rowBytes, i + 1 == job.bands.size());
+			}
+			catch (...)
+			{
+				job.bands[i].error = std::current_exception();
+			}
+
+			std::lock_guard<std::mutex> lock(job.mutex);
+			if (++job.doneBands == job.bands.size())
+			{
+				job.finished.notify_all();
+			}
+		}
+	}
+} //namespace
+
+void EncodeBandedPng(std::vector<uint8_t>& png, uint32_t width, uint32_t height, uint32_t bitsPerChannel,
+	const uint8_t* pixData, size_t pixDataSize, const std::vector<uint32_t>& palette, WorkerPool* pool)
+{
+	CHECK_EX(width > 0 && height > 0, "Empty PNG image");
+	CHECK_EX(bitsPerChannel == 1 || bitsPerChannel == 2 || bitsPerChannel == 4 || bitsPerChannel == 8, "Unsupported PNG bit depth");
+	CHECK_EX(palette.size() <= (size_t(1) << bitsPerChannel), "PNG palette is larger than bit depth allows");
+	const auto rowBytes = (static_cast<size_t>(width) * bitsPerChannel + 7) / 8;
+	CHECK_EX(pixDataSize == rowBytes * height, "PNG image data size doesn't match dimensions");
+
+	const auto bandRows = static_cast<uint32_t>(std::max<size_t>(1, BandBytes / (rowBytes + 1)));
+	const auto job = std::make_shared<BandJob>();
+	job->pixData = pixData;
+	job->rowBytes = rowBytes;
+	job->bands.resize((height + bandRows - 1) / bandRows);
+	for (size_t i = 0; i < job->bands.size(); ++i)
+	{
+		job->bands[i].firstRow = static_cast<uint32_t>(i * bandRows);
+		job->bands[i].rows = std::min(bandRows, height - job->bands[i].firstRow);
+	}
+
+	if (pool)
+	{
+		for (size_t i = 1; i < std::min(pool->GetThreadCount() + 1, job->bands.size()); ++i)
+		{
+			pool->Submit([job]() { DeflateBands(*job); });
+		}
+	}
+	DeflateBands(*job);
+	// only bands taken by workers are waited for, not queued tasks
+	{
+		std::unique_lock<std::mutex> lock(job->mutex);
+		job->finished.wait(lock, [&job]() { return job->doneBands == job->bands.size(); });
+	}
+	const auto& bands = job->bands;
+
+	size_t deflatedSize = 0;
+	for (const auto& band : bands)
+	{
+		if (band.error)
+		{
+			std::rethrow_exception(band.error);
+		}
+		deflatedSize += band.deflated.size();
+	}
+
+	png.clear();
+	png.reserve(deflatedSize + 1024);
+	const uint8_t Signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	png.insert(png.end(), Signature, Signature + sizeof(Signature));
+
+	std::vector<uint8_t> header;
+	PutUInt32(header, width);
+	PutUInt32(header, height);
+	const uint8_t ColorTypeGray = 0;
+	const uint8_t ColorTypePalette = 3;
+	// bit depth, color type, compression, filter, interlace
+	const uint8_t headerTail[] = { static_cast<uint8_t>(bitsPerChannel), palette.empty() ? ColorTypeGray : ColorTypePalette, 0, 0, 0 };
+	header.insert(header.end(), headerTail, headerTail + sizeof(headerTail));
+	PutChunk(png, "IHDR", header);
+
+	// same color space chunks as png_set_sRGB_gAMA_and_cHRM writes
+	std::vector<uint8_t> gamma;
+	PutUInt32(gamma, 45455);
+	PutChunk(png, "gAMA", gamma);
+	std::vector<uint8_t> chromaticities;
+	for (auto v : { 31270, 32900, 64000, 33000, 30000, 60000, 15000, 6000 })
+	{
+		PutUInt32(chromaticities, v);
+	}
+	PutChunk(png, "cHRM", chromaticities);
+	const uint8_t PerceptualIntent = 0;
+	PutChunk(png, "sRGB", std::vector<uint8_t>(1, PerceptualIntent));
+
+	if (!palette.empty())
+	{
+		std::vector<uint8_t> entries;
+		for (auto color : palette)
+		{
+			const uint8_t rgb[] = { static_cast<uint8_t>(color), static_cast<uint8_t>(color >> 8), static_cast<uint8_t>(color >> 16) };
+			entries.insert(entries.end(), rgb, rgb + sizeof(rgb));
+		}
+		PutChunk(png, "PLTE", entries);
+	}
+
+	// IDAT is assembled from bands, its CRC and zlib checksum are combined from band ones
+	const uint8_t ZlibHeader[] = { 0x78, 0x01 };
+	uLong adler = 1;
+	size_t rawOffset = 0;
+	uLong crc = crc32(0, reinterpret_cast<const Bytef*>("IDAT"), 4);
+	crc = crc32(crc, ZlibHeader, sizeof(ZlibHeader));
+	PutUInt32(png, static_cast<uint32_t>(sizeof(ZlibHeader) + deflatedSize + 4));
+	png.insert(png.end(), { 'I', 'D', 'A', 'T' });
+	png.insert(png.end(), ZlibHeader, ZlibHeader + sizeof(ZlibHeader));
+	for (const auto& band : bands)
+	{
+		png.insert(png.end(), band.deflated.begin(), band.deflated.end());
+		const auto rawSize = (rowBytes + 1) * band.rows;
+		adler = rawOffset == 0 ? band.adler : adler32_combine(adler, band.adler, static_cast<z_off_t>(rawSize));
+		rawOffset += rawSize;
+		crc = crc32_combine(crc, band.crc, static_cast<z_off_t>(band.deflated.size()));
+	}
+	std::vector<uint8_t> checksum;
+	PutUInt32(checksum, static_cast<uint32_t>(adler));
+	png.insert(png.end(), checksum.begin(), checksum.end());
+	crc = crc32(crc, checksum.data(), static_cast<uInt>(checksum.size()));
+	PutUInt32(png, static_cast<uint32_t>(crc));
+
+	PutChunk(png, "IEND", std::vector<uint8_t>());
+}
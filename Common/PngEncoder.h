@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class WorkerPool;
+
+// PNG encoder for single channel slice images (grayscale, or palette if palette is set).
+// Rows are split into bands of fixed size, which are deflated in parallel with run-length strategy
+// and joined at sync flush points into single IDAT (Perfactory reader needs whole image in one IDAT).
+// Calling thread deflates bands, workers of pool (if any) join it. Band size depends on image only, so output
+// is same with or without pool. Rows of 1, 2 or 4-bit images are packed and start at byte boundary.
+void EncodeBandedPng(std::vector<uint8_t>& png, uint32_t width, uint32_t height, uint32_t bitsPerChannel,
+	const uint8_t* pixData, size_t pixDataSize, const std::vector<uint32_t>& palette, WorkerPool* pool = nullptr);
@@ -1,8 +1,16 @@
 #include "PngFile.h"
+#include "PngEncoder.h"
 
 #include <png.h>
+#include <algorithm>
+#include <array>
 #include <stdexcept>
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define PNGFILE_SSE2
+#endif
+
 std::vector<uint32_t> CreateGrayscalePalette()
 {
 	std::vector<uint32_t> palette(256);
@@ -112,114 +120,256 @@ std::vector<uint8_t> ReadPng(const std::string& fileName, uint32_t& width, uint3
 	}
 }
 
-void WritePng(const std::string& fileName, uint32_t width, uint32_t height, uint32_t bitsPerChannel,
-	const std::vector<uint8_t>& pixData, const std::vector<uint32_t>& palette)
+namespace
 {
-	FILE *fp = nullptr;
-	png_structp png_ptr = nullptr;
-	png_infop info_ptr = nullptr;
-	try
+	struct MemoryReader
 	{
-		/* create file */
-		fp = fopen(fileName.c_str(), "wb");
-		if (!fp)
-			throw std::runtime_error("Can't create png file");
+		const std::vector<uint8_t>* buffer;
+		size_t pos;
+	};
 
-		/* initialize stuff */
-		png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-		if (!png_ptr)
-			throw std::runtime_error("png_create_write_struct failed");
+	void ReadFromBuffer(png_structp png_ptr, png_bytep data, png_size_t length)
+	{
+		auto reader = static_cast<MemoryReader*>(png_get_io_ptr(png_ptr));
+		if (reader->pos + length > reader->buffer->size())
+		{
+			png_error(png_ptr, "Unexpected end of PNG data");
+		}
+		std::copy(reader->buffer->begin() + reader->pos, reader->buffer->begin() + reader->pos + length, data);
+		reader->pos += length;
+	}
 
-		info_ptr = png_create_info_struct(png_ptr);
-		if (!info_ptr)
-			throw std::runtime_error("png_create_info_struct failed");
+	const size_t MaxPackedLevels = 16;
 
-		if (setjmp(png_jmpbuf(png_ptr)))
-			throw std::runtime_error("Error during init_io");
+	// Collects distinct values of raster in ascending order, stops when there are more than MaxPackedLevels.
+	std::vector<uint8_t> FindLevels(const uint8_t* pixData, size_t size)
+	{
+		std::array<bool, 256> used{};
+		size_t count = 0;
+		uint8_t last = pixData[0];
+		used[last] = true;
+		++count;
+
+		size_t i = 0;
+#ifdef PNGFILE_SSE2
+		// slices are mostly long runs of one value
+		for (; i + 16 <= size && count <= MaxPackedLevels; i += 16)
+		{
+			const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixData + i));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(static_cast<char>(last)))) == 0xFFFF)
+			{
+				continue;
+			}
+			for (auto j = i; j < i + 16; ++j)
+			{
+				last = pixData[j];
+				count += used[last] ? 0 : 1;
+				used[last] = true;
+			}
+		}
+#endif
+		for (; i < size && count <= MaxPackedLevels; ++i)
+		{
+			last = pixData[i];
+			count += used[last] ? 0 : 1;
+			used[last] = true;
+		}
 
-		png_init_io(png_ptr, fp);
+		std::vector<uint8_t> levels;
+		for (size_t level = 0; level < used.size() && levels.size() <= MaxPackedLevels; ++level)
+		{
+			if (used[level])
+			{
+				levels.push_back(static_cast<uint8_t>(level));
+			}
+		}
+		return levels;
+	}
 
-		/* write header */
-		if (setjmp(png_jmpbuf(png_ptr)))
-			throw std::runtime_error("Error during writing header");
+	uint8_t ReverseBits(uint8_t v)
+	{
+		v = static_cast<uint8_t>((v & 0xF0) >> 4 | (v & 0x0F) << 4);
+		v = static_cast<uint8_t>((v & 0xCC) >> 2 | (v & 0x33) << 2);
+		return static_cast<uint8_t>((v & 0xAA) >> 1 | (v & 0x55) << 1);
+	}
 
-		auto nChannels = pixData.size() / (width * height);
-		auto color_type = 0;
-		switch (nChannels)
+	// 1-bit row, pixel equal to one is set, first pixel is most significant bit
+	void PackRow1(const uint8_t* src, uint8_t* dst, uint32_t width, uint8_t one)
+	{
+		static const auto reversed = []() {
+			std::array<uint8_t, 256> table;
+			for (size_t i = 0; i < table.size(); ++i)
+			{
+				table[i] = ReverseBits(static_cast<uint8_t>(i));
+			}
+			return table;
+		}();
+
+		uint32_t x = 0;
+#ifdef PNGFILE_SSE2
+		const auto oneVector = _mm_set1_epi8(static_cast<char>(one));
+		for (; x + 16 <= width; x += 16)
 		{
-		case 1:
-			color_type = palette.empty() ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_PALETTE;
-			break;
-		case 3:
-			color_type = PNG_COLOR_TYPE_RGB;
-			break;
-		case 4:
-			color_type = PNG_COLOR_TYPE_RGBA;
-			break;
-		default:
-			throw std::runtime_error("Can only write 1, 3 or 4 channel PNG");
+			const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+			const auto mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, oneVector));
+			dst[x / 8] = reversed[mask & 0xFF];
+			dst[x / 8 + 1] = reversed[(mask >> 8) & 0xFF];
 		}
+#endif
+		for (; x < width; x += 8)
+		{
+			uint8_t byte = 0;
+			for (uint32_t i = 0; i < 8; ++i)
+			{
+				byte = static_cast<uint8_t>(byte << 1 | (x + i < width && src[x + i] == one ? 1 : 0));
+			}
+			dst[x / 8] = byte;
+		}
+	}
 
-		if (color_type == PNG_COLOR_TYPE_PALETTE)
+	// 2 or 4-bit row of level indices, first pixel in most significant bits
+	void PackRow(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t bits, const std::array<uint8_t, 256>& index)
+	{
+		const auto perByte = 8 / bits;
+		for (uint32_t x = 0; x < width; x += perByte)
 		{
-			std::vector<png_color> pngPalette(palette.size());
-			for (size_t i = 0; i < palette.size(); ++i)
+			uint32_t byte = 0;
+			for (uint32_t i = 0; i < perByte; ++i)
 			{
-				pngPalette[i].red = palette[i] & 0xFF;
-				pngPalette[i].green = (palette[i] >> 8) & 0xFF;
-				pngPalette[i].blue = (palette[i] >> 16) & 0xFF;
+				byte = byte << bits | (x + i < width ? index[src[x + i]] : 0);
 			}
-			png_set_PLTE(png_ptr, info_ptr, &pngPalette[0], static_cast<int>(pngPalette.size()));
+			dst[x / perByte] = static_cast<uint8_t>(byte);
 		}
+	}
+} //namespace
 
-		png_set_IHDR(png_ptr, info_ptr, width, height,
-			bitsPerChannel, color_type, PNG_INTERLACE_NONE,
-			PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
-		png_set_filter(png_ptr, 0, PNG_NO_FILTERS);
-		png_set_sRGB_gAMA_and_cHRM(png_ptr, info_ptr, PNG_sRGB_INTENT_PERCEPTUAL);
+void EncodePackedPng(std::vector<uint8_t>& png, uint32_t width, uint32_t height,
+	const uint8_t* pixData, size_t pixDataSize, const std::vector<uint32_t>& palette, WorkerPool* pool)
+{
+	if (pixDataSize == 0 || pixDataSize != static_cast<size_t>(width) * height)
+	{
+		throw std::runtime_error("Can only pack single channel 8-bit raster");
+	}
 
-		const auto DefaultCompressionLevel = 1;
-		png_set_compression_level(png_ptr, DefaultCompressionLevel);
-		// set large buffer to write whole image in single IDAT
-		// to workaround Perfactory PNG reader bug.
-		png_set_compression_buffer_size(png_ptr, pixData.size()); 
-		
-		png_write_info(png_ptr, info_ptr);
+	const auto levels = FindLevels(pixData, pixDataSize);
+	if (levels.size() > MaxPackedLevels)
+	{
+		EncodeBandedPng(png, width, height, 8, pixData, pixDataSize, palette, pool);
+		return;
+	}
 
-		/* write bytes */
-		if (setjmp(png_jmpbuf(png_ptr)))
-			throw std::runtime_error("Error during writing bytes");
+	const uint32_t bits = levels.size() <= 2 ? 1 : levels.size() <= 4 ? 2 : 4;
+	std::vector<uint32_t> packedPalette(levels.size());
+	std::array<uint8_t, 256> index{};
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		packedPalette[i] = palette.empty() ? levels[i] * 0x010101u : palette[levels[i]];
+		index[levels[i]] = static_cast<uint8_t>(i);
+	}
 
-		std::vector<const uint8_t*> row_pointers(height);
-		for (auto i = 0u; i < height; ++i)
+	const auto rowBytes = (static_cast<size_t>(width) * bits + 7) / 8;
+	std::vector<uint8_t> packed(rowBytes * height);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		const auto src = pixData + static_cast<size_t>(width) * y;
+		const auto dst = &packed[rowBytes * y];
+		if (bits == 1)
+		{
+			// single level image stays all zero
+			if (levels.size() == 2)
+			{
+				PackRow1(src, dst, width, levels[1]);
+			}
+		}
+		else
 		{
-			row_pointers[i] = &pixData[width * nChannels * i];
+			PackRow(src, dst, width, bits, index);
 		}
+	}
 
-		png_write_image(png_ptr, const_cast<uint8_t**>(&row_pointers[0]));
+	EncodeBandedPng(png, width, height, bits, packed.data(), packed.size(), packedPalette, pool);
+}
 
+void DecodePng(const std::vector<uint8_t>& png, uint32_t& width, uint32_t& height, std::vector<uint8_t>& pixData)
+{
+	png_structp png_ptr = nullptr;
+	png_infop info_ptr = nullptr;
+
+	try
+	{
+		if (png.size() < 8 || png_sig_cmp(png.data(), 0, 8))
+			throw std::runtime_error("Data is not recognized as PNG");
+
+		png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+		if (!png_ptr)
+			throw std::runtime_error("png_create_read_struct failed");
+
+		info_ptr = png_create_info_struct(png_ptr);
+		if (!info_ptr)
+			throw std::runtime_error("png_create_info_struct failed");
 
-		/* end write */
 		if (setjmp(png_jmpbuf(png_ptr)))
-			throw std::runtime_error("[write_png_file] Error during end of write");
+			throw std::runtime_error("Error during PNG decoding");
 
-		png_write_end(png_ptr, NULL);
-		png_destroy_write_struct(&png_ptr, &info_ptr);
-		fclose(fp);
-		fp = nullptr;
-	}
-	catch (const std::exception&)
-	{
-		if (fp)
+		MemoryReader reader{ &png, 0 };
+		png_set_read_fn(png_ptr, &reader, ReadFromBuffer);
+		png_read_info(png_ptr, info_ptr);
+
+		const auto color_type = png_get_color_type(png_ptr, info_ptr);
+		if ((color_type != PNG_COLOR_TYPE_GRAY && color_type != PNG_COLOR_TYPE_PALETTE) ||
+			png_get_bit_depth(png_ptr, info_ptr) > 8)
+			throw std::runtime_error("PNG decoder: can only read grayscale or palette images up to 8 bits");
+
+		// low bit depth palette holds gray levels, 8-bit palette maps gray level to itself
+		std::array<uint8_t, 256> levels;
+		for (size_t i = 0; i < levels.size(); ++i)
 		{
-			fclose(fp);
+			levels[i] = static_cast<uint8_t>(i);
+		}
+		const auto lowBitDepth = png_get_bit_depth(png_ptr, info_ptr) < 8;
+		if (color_type == PNG_COLOR_TYPE_PALETTE && lowBitDepth)
+		{
+			png_colorp pngPalette = nullptr;
+			int paletteSize = 0;
+			png_get_PLTE(png_ptr, info_ptr, &pngPalette, &paletteSize);
+			for (int i = 0; i < paletteSize; ++i)
+			{
+				levels[i] = pngPalette[i].red;
+			}
+			png_set_packing(png_ptr);
+		}
+		else if (lowBitDepth)
+		{
+			png_set_expand_gray_1_2_4_to_8(png_ptr);
 		}
+		png_read_update_info(png_ptr, info_ptr);
 
+		width = png_get_image_width(png_ptr, info_ptr);
+		height = png_get_image_height(png_ptr, info_ptr);
+		pixData.resize(static_cast<size_t>(width) * height);
+		std::vector<uint8_t*> rowPointers(height);
+		for (auto y = 0u; y < height; ++y)
+		{
+			rowPointers[y] = &pixData[static_cast<size_t>(width) * y];
+		}
+		png_read_image(png_ptr, rowPointers.data());
+		png_read_end(png_ptr, nullptr);
+		if (color_type == PNG_COLOR_TYPE_PALETTE && lowBitDepth)
+		{
+			for (auto& pixel : pixData)
+			{
+				pixel = levels[pixel];
+			}
+		}
+		png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+	}
+	catch (const std::exception&)
+	{
 		if (png_ptr || info_ptr)
 		{
-			png_destroy_write_struct(&png_ptr, &info_ptr);
+			png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
 		}
 
 		throw;
 	}
-}
\ No newline at end of file
+}
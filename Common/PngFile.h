@@ -2,12 +2,18 @@
 
 #include <vector>
 #include <string>
+#include <cstddef>
 #include <cstdint>
 
+class WorkerPool;
+
 std::vector<uint8_t> ReadPng(const std::string& fileName,
 	uint32_t& width, uint32_t& height, uint32_t& bitsPerPixel);
-void WritePng(const std::string& fileName,
-	uint32_t width, uint32_t height, uint32_t bitsPerChannel,
-	const std::vector<uint8_t>& pixData, const std::vector<uint32_t>& palette = std::vector<uint32_t>());
+// Encodes 8-bit single channel raster as 1, 2 or 4-bit palette PNG of its gray levels if it has at most 16 of them,
+// as 8-bit PNG otherwise, with EncodeBandedPng. Palette maps gray level to color, grayscale if empty.
+void EncodePackedPng(std::vector<uint8_t>& png, uint32_t width, uint32_t height,
+	const uint8_t* pixData, size_t pixDataSize, const std::vector<uint32_t>& palette = std::vector<uint32_t>(), WorkerPool* pool = nullptr);
+// Decodes single channel PNG from memory to 8-bit gray levels (palette indices for 8-bit palette images).
+void DecodePng(const std::vector<uint8_t>& png, uint32_t& width, uint32_t& height, std::vector<uint8_t>& pixData);
 
 std::vector<uint32_t> CreateGrayscalePalette();
\ No newline at end of file
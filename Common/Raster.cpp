@@ -1,142 +1,116 @@
 #include "Raster.h"
+#include "RunRaster.h"
 
 #include <ErrorHandling.h>
 
 #include <algorithm>
 #include <iterator>
-#include <unordered_map>
-#include <map>
 
 
-void Dilate(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height)
+namespace
 {
-	for (auto y = 1; y < height-1; ++y)
+	// Calls action once for each distinct segment label in 3x3 neighbourhood of (x, y).
+	template <typename Action>
+	void ForEachNeighbourSegment(const std::vector<uint32_t>& segmentedRaster, int x, int y, int width, int height, const Action& action)
 	{
-		for (auto x = 1; x < width-1; ++x)
+		const auto current = segmentedRaster[y * width + x];
+		if (current != 0)
 		{
-			auto m = in[y * width + x];
-			m = std::max(m, in[(y - 1) * width + (x - 1)]);
-			m = std::max(m, in[(y - 1) * width + (x + 0)]);
-			m = std::max(m, in[(y - 1) * width + (x + 1)]);
-			m = std::max(m, in[(y + 0) * width + (x - 1)]);
-			m = std::max(m, in[(y + 0) * width + (x + 1)]);
-			m = std::max(m, in[(y + 1) * width + (x - 1)]);
-			m = std::max(m, in[(y + 1) * width + (x + 0)]);
-			m = std::max(m, in[(y + 1) * width + (x + 1)]);
-
-			out[y * width + x] = m;
+			// 8-connected neighbours of labeled pixel can only be of the same segment
+			action(current);
+			return;
 		}
+
+		uint32_t found[8];
+		size_t foundCount = 0;
+		ForEachPixel(ExpandRange(x, x + 1, 0, width), ExpandRange(y, y + 1, 0, height), [&](auto x, auto y) {
+			const auto label = segmentedRaster[y * width + x];
+			if (label != 0 && std::find(found, found + foundCount, label) == found + foundCount)
+			{
+				found[foundCount++] = label;
+				action(label);
+			}
+		});
 	}
-}
+} //namespace
 
 void Segmentize(const std::vector<uint8_t>& in, std::vector<uint32_t>& out, std::vector<Segment>& segments,
 	const int width, const int height, const uint8_t threshold)
 {
 	ASSERT(in.size() == out.size());
-	// TODO: process edges
-	std::map<uint32_t, uint32_t> segmentNumberMap;
-	segmentNumberMap[0] = 0;
+	LabelComponents(RunRaster::FromBytes(in, width, height, threshold), out, segments);
+}
+
+std::vector<float> CalculateSegmentsArea(const std::vector<Segment>& segments, float physPixelArea,
+	const std::vector<uint8_t>& raster, const std::vector<uint32_t>& segmentedRaster, int width, int height)
+{
+	ASSERT(raster.size() == segmentedRaster.size());
 
-	uint32_t currentSegmentNumber = 1;
-	for (auto y = 1; y < height; ++y)
+	std::vector<float> area(segments.size() + 1, 0.0f);
+	for (auto y = 0; y < height; ++y)
 	{
-		for (auto x = 1; x < width - 1; ++x)
+		for (auto x = 0; x < width; ++x)
 		{
-			if (in[y * width + x] >= threshold)
+			const auto currentPixel = raster[y * width + x];
+			if (currentPixel == 0)
 			{
-				const uint32_t samples[] =
-				{
-					out[(y - 1) * width + x - 1],
-					out[(y - 1) * width + x],
-					out[(y - 1) * width + x + 1],
-					out[y * width + x - 1],
-				};
-
-				if (samples[0] == 0 && samples[1] == 0 && samples[2] == 0 && samples[3] == 0)
-				{
-					out[y * width + x] = currentSegmentNumber;
-					segmentNumberMap[currentSegmentNumber] = currentSegmentNumber;
-					++currentSegmentNumber;
-				}
-				else
-				{
-					const auto max = std::max(std::max(samples[0], samples[1]), std::max(samples[2], samples[3]));
-					out[y * width + x] = max;
-
-					for (auto v : samples)
-					{
-						if (v != 0)
-						{
-							auto it = segmentNumberMap.find(v);
-							it->second = std::max(it->second, max);
-						}
-					}
-				}
-			}
-			else
-			{
-				out[y * width + x] = 0;
+				continue;
 			}
+
+			const auto pixelArea = physPixelArea * currentPixel / 255.0f;
+			ForEachNeighbourSegment(segmentedRaster, x, y, width, height, [&](uint32_t label) {
+				area[label] += pixelArea;
+			});
 		}
 	}
 
-	bool allMerged = false;
-	while (!allMerged)
+	return area;
+}
+
+void FillSegments(const std::vector<uint8_t>& fillTable, std::vector<uint8_t>& raster,
+	const std::vector<uint32_t>& segmentedRaster, int width, int height)
+{
+	ASSERT(raster.size() == segmentedRaster.size());
+
+	for (auto y = 0; y < height; ++y)
 	{
-		allMerged = true;
-		for (auto it = segmentNumberMap.begin(); it != segmentNumberMap.end(); ++it)
+		for (auto x = 0; x < width; ++x)
 		{
-			if (segmentNumberMap[it->second] != it->second)
+			auto& currentPixel = raster[y * width + x];
+			if (currentPixel == 0)
 			{
-				it->second = segmentNumberMap[it->second];
-				allMerged = false;
+				continue;
 			}
-		}
-	}
 
-	std::unordered_map<uint32_t, Segment> segmentData;
-	for (size_t i = 0; i < out.size(); ++i)
-	{
-		const auto current = out[i] = segmentNumberMap[out[i]];
-		const auto currentX = static_cast<int>(i % width);
-		const auto currentY = static_cast<int>(i / width);
-		if (current > 0)
-		{
-			auto it = segmentData.find(current);
-			if (it == segmentData.end())
+			bool touchesSegment = false;
+			uint8_t fillValue = 0;
+			ForEachNeighbourSegment(segmentedRaster, x, y, width, height, [&](uint32_t label) {
+				touchesSegment = true;
+				fillValue = std::max(fillValue, fillTable[label]);
+			});
+
+			if (touchesSegment)
 			{
-				it = segmentData.emplace(current, Segment{ current, 0, currentX, currentY, currentX+1, currentY+1}).first;
+				currentPixel = fillValue;
 			}
-			++it->second.count;
-			it->second.xBegin = std::min(it->second.xBegin, currentX);
-			it->second.yBegin = std::min(it->second.yBegin, currentY);
-			it->second.xEnd = std::max(it->second.xEnd, currentX+1);
-			it->second.yEnd = std::max(it->second.yEnd, currentY+1);
 		}
 	}
-
-	segments.reserve(segmentData.size());
-	std::transform(segmentData.begin(), segmentData.end(), std::back_inserter(segments), [](const auto& v) {
-		return v.second;
-	});
 }
 
-float CalculateSegmentArea(const Segment& segment, float physPixelArea, const std::vector<uint8_t>& raster, const std::vector<uint32_t>& segmentedRaster, int width, int height)
+void MirrorRaster(uint8_t* raster, int width, int height, bool mirrorX, bool mirrorY)
 {
-	const auto xRange = ExpandRange(segment.xBegin, segment.xEnd, 0, width);
-	const auto yRange = ExpandRange(segment.yBegin, segment.yEnd, 0, height);
-
-	float area = 0.0f;
-	ForEachPixel(xRange, yRange, [&](auto x, auto y)
+	if (mirrorX)
 	{
-		const auto currentPixel = raster[y*width + x];
-
-		if (currentPixel > 0 && AnyOfPixels(ExpandRange(x, x + 1, 0, width), ExpandRange(y, y + 1, 0, height),
-			[&](auto x, auto y) { return segmentedRaster[y*width + x] == segment.val; }))
+		for (auto y = 0; y < height; ++y)
 		{
-			area += physPixelArea * currentPixel / 255.0f;
+			std::reverse(raster + y * width, raster + (y + 1) * width);
 		}
-	});
-
-	return area;
-}
\ No newline at end of file
+	}
+	if (mirrorY)
+	{
+		for (auto y = 0; y < height / 2; ++y)
+		{
+			std::swap_ranges(raster + y * width, raster + (y + 1) * width, raster + (height - 1 - y) * width);
+		}
+	}
+}
@@ -4,8 +4,6 @@
 #include <vector>
 #include <utility>
 
-void Dilate(const std::vector<uint8_t>& in, std::vector<uint8_t>& out, int width, int height);
-
 struct Segment
 {
 	uint32_t val;
@@ -17,9 +15,19 @@ struct Segment
 void Segmentize(const std::vector<uint8_t>& in, std::vector<uint32_t>& out, std::vector<Segment>& segments,
 	const int width, const int height, const uint8_t threshold = 1);
 
-float CalculateSegmentArea(const Segment& segment, float physPixelArea,
+// Segment labels are compact: segments[i].val == i + 1, label 0 is background.
+// Area of each segment is the coverage-weighted area of all nonzero pixels touching it (3x3),
+// result is indexed by label.
+std::vector<float> CalculateSegmentsArea(const std::vector<Segment>& segments, float physPixelArea,
 	const std::vector<uint8_t>& raster, const std::vector<uint32_t>& segmentedRaster, int width, int height);
 
+// Set every nonzero pixel touching labeled segment to fillTable[label] (max if touches several).
+void FillSegments(const std::vector<uint8_t>& fillTable, std::vector<uint8_t>& raster,
+	const std::vector<uint32_t>& segmentedRaster, int width, int height);
+
+// In-place flip of 8-bit raster: mirrorX reverses columns, mirrorY reverses rows.
+void MirrorRaster(uint8_t* raster, int width, int height, bool mirrorX, bool mirrorY);
+
 inline std::pair<int, int> ExpandRange(int begin, int end, int min, int max)
 {
 	return std::make_pair(begin > min ? begin - 1 : begin, end < max ? end + 1 : end);
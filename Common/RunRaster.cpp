@@ -0,0 +1,227 @@
+#include "RunRaster.h"
+
+#include <ErrorHandling.h>
+
+#include <algorithm>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RUNRASTER_SSE2
+#endif
+
+namespace
+{
+	uint32_t FindRoot(std::vector<uint32_t>& parent, uint32_t v)
+	{
+		while (parent[v] != v)
+		{
+			parent[v] = parent[parent[v]];
+			v = parent[v];
+		}
+		return v;
+	}
+
+	void Merge(std::vector<uint32_t>& parent, uint32_t a, uint32_t b)
+	{
+		a = FindRoot(parent, a);
+		b = FindRoot(parent, b);
+		// smallest index is a root, so roots always precede their members
+		parent[std::max(a, b)] = std::min(a, b);
+	}
+} //namespace
+
+RunRaster::RunRaster() : width_(0), height_(0), rowsStarted_(0)
+{
+}
+
+RunRaster::RunRaster(int width, int height) :
+	width_(width),
+	height_(height),
+	rowsStarted_(0),
+	rowOffsets_(height, 0)
+{
+}
+
+RunRaster RunRaster::FromBytes(const std::vector<uint8_t>& raster, int width, int height, uint8_t threshold)
+{
+	ASSERT(raster.size() == static_cast<size_t>(width) * height);
+
+	RunRaster result(width, height);
+	for (auto y = 0; y < height; ++y)
+	{
+		result.AppendRow(&raster[static_cast<size_t>(y) * width], threshold);
+	}
+	return result;
+}
+
+void RunRaster::ToBytes(std::vector<uint8_t>& raster, uint8_t value) const
+{
+	raster.assign(static_cast<size_t>(width_) * height_, 0);
+	for (auto y = 0; y < height_; ++y)
+	{
+		const auto row = raster.begin() + static_cast<size_t>(y) * width_;
+		std::for_each(RowBegin(y), RowEnd(y), [&row, value](const Run& run) {
+			std::fill(row + run.xBegin, row + run.xEnd, value);
+		});
+	}
+}
+
+void RunRaster::AppendRow(const uint8_t* pixels, uint8_t threshold)
+{
+	const auto y = rowsStarted_;
+	ASSERT(y < height_);
+	CloseRows(y);
+
+	auto runBegin = -1;
+	auto x = 0;
+	while (x < width_)
+	{
+#ifdef RUNRASTER_SSE2
+		// skip blocks of 16 pixels without transition
+		const auto BlockSize = 16;
+		if (x + BlockSize <= width_)
+		{
+			const auto thresholdVector = _mm_set1_epi8(static_cast<char>(threshold));
+			const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x));
+			const auto mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, thresholdVector), v));
+			if (mask == (runBegin < 0 ? 0 : 0xFFFF))
+			{
+				x += BlockSize;
+				continue;
+			}
+		}
+#endif
+		const auto isSet = pixels[x] >= threshold;
+		if (isSet && runBegin < 0)
+		{
+			runBegin = x;
+		}
+		else if (!isSet && runBegin >= 0)
+		{
+			runs_.push_back(Run{ runBegin, x });
+			runBegin = -1;
+		}
+		++x;
+	}
+
+	if (runBegin >= 0)
+	{
+		runs_.push_back(Run{ runBegin, width_ });
+	}
+}
+
+void RunRaster::AppendRun(int y, int xBegin, int xEnd)
+{
+	ASSERT(y >= rowsStarted_ - 1 && y < height_);
+	if (xBegin >= xEnd)
+	{
+		return;
+	}
+
+	CloseRows(y);
+	if (GetRowIndex(y) < runs_.size() && runs_.back().xEnd >= xBegin)
+	{
+		runs_.back().xEnd = std::max(runs_.back().xEnd, xEnd);
+		return;
+	}
+	runs_.push_back(Run{ xBegin, xEnd });
+}
+
+void RunRaster::CloseRows(int y)
+{
+	while (rowsStarted_ <= y)
+	{
+		rowOffsets_[rowsStarted_++] = runs_.size();
+	}
+}
+
+size_t RunRaster::GetRowIndex(int y) const
+{
+	return y < rowsStarted_ ? rowOffsets_[y] : runs_.size();
+}
+
+const Run* RunRaster::RowBegin(int y) const
+{
+	return runs_.data() + GetRowIndex(y);
+}
+
+const Run* RunRaster::RowEnd(int y) const
+{
+	return runs_.data() + GetRowIndex(y + 1);
+}
+
+std::vector<uint32_t> LabelRuns(const RunRaster& raster, std::vector<Segment>& segments)
+{
+	const auto runCount = static_cast<uint32_t>(raster.GetRunCount());
+	std::vector<uint32_t> parent(runCount);
+	for (uint32_t i = 0; i < runCount; ++i)
+	{
+		parent[i] = i;
+	}
+
+	const auto runs = raster.RowBegin(0);
+	for (auto y = 1; y < raster.GetHeight(); ++y)
+	{
+		auto previous = raster.RowBegin(y - 1);
+		const auto previousEnd = raster.RowEnd(y - 1);
+		for (auto current = raster.RowBegin(y); current != raster.RowEnd(y); ++current)
+		{
+			// runs of previous row touching [xBegin - 1, xEnd] are 8-connected
+			while (previous != previousEnd && previous->xEnd < current->xBegin)
+			{
+				++previous;
+			}
+			for (auto it = previous; it != previousEnd && it->xBegin <= current->xEnd; ++it)
+			{
+				Merge(parent, static_cast<uint32_t>(current - runs), static_cast<uint32_t>(it - runs));
+			}
+		}
+	}
+
+	std::vector<uint32_t> runLabel(runCount);
+	uint32_t segmentCount = 0;
+	for (uint32_t i = 0; i < runCount; ++i)
+	{
+		const auto root = FindRoot(parent, i);
+		runLabel[i] = root == i ? ++segmentCount : runLabel[root];
+	}
+
+	segments.clear();
+	segments.reserve(segmentCount);
+	for (uint32_t label = 1; label <= segmentCount; ++label)
+	{
+		segments.push_back(Segment{ label, 0, raster.GetWidth(), raster.GetHeight(), 0, 0 });
+	}
+
+	for (auto y = 0; y < raster.GetHeight(); ++y)
+	{
+		for (auto run = raster.RowBegin(y); run != raster.RowEnd(y); ++run)
+		{
+			auto& segment = segments[runLabel[run - runs] - 1];
+			segment.count += run->xEnd - run->xBegin;
+			segment.xBegin = std::min(segment.xBegin, run->xBegin);
+			segment.yBegin = std::min(segment.yBegin, y);
+			segment.xEnd = std::max(segment.xEnd, run->xEnd);
+			segment.yEnd = std::max(segment.yEnd, y + 1);
+		}
+	}
+
+	return runLabel;
+}
+
+void LabelComponents(const RunRaster& raster, std::vector<uint32_t>& labels, std::vector<Segment>& segments)
+{
+	const auto runLabel = LabelRuns(raster, segments);
+	const auto runs = raster.RowBegin(0);
+	const auto width = static_cast<size_t>(raster.GetWidth());
+
+	labels.assign(width * raster.GetHeight(), 0);
+	for (auto y = 0; y < raster.GetHeight(); ++y)
+	{
+		const auto row = labels.begin() + y * width;
+		for (auto run = raster.RowBegin(y); run != raster.RowEnd(y); ++run)
+		{
+			std::fill(row + run->xBegin, row + run->xEnd, runLabel[run - runs]);
+		}
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Raster.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Horizontal span of set pixels [xBegin, xEnd)
+struct Run
+{
+	int xBegin;
+	int xEnd;
+};
+
+// Binary raster stored as sorted, non-touching runs per row.
+// Rows are built in order with AppendRow/AppendRun.
+class RunRaster
+{
+public:
+	RunRaster();
+	RunRaster(int width, int height);
+
+	// pixels >= threshold become set
+	static RunRaster FromBytes(const std::vector<uint8_t>& raster, int width, int height, uint8_t threshold = 1);
+	// set pixels become value, others 0
+	void ToBytes(std::vector<uint8_t>& raster, uint8_t value = 0xFF) const;
+
+	// Appends next row of width pixels, pixels >= threshold become set
+	void AppendRow(const uint8_t* pixels, uint8_t threshold = 1);
+	// Appends run to row y, rows below y are closed. Runs must come in increasing x order.
+	void AppendRun(int y, int xBegin, int xEnd);
+
+	int GetWidth() const { return width_; }
+	int GetHeight() const { return height_; }
+
+	const Run* RowBegin(int y) const;
+	const Run* RowEnd(int y) const;
+	size_t GetRowIndex(int y) const;
+	size_t GetRunCount() const { return runs_.size(); }
+
+private:
+	void CloseRows(int y);
+
+	int width_;
+	int height_;
+	// rows [0, rowsStarted_) have their first run index in rowOffsets_
+	int rowsStarted_;
+	std::vector<Run> runs_;
+	std::vector<size_t> rowOffsets_;
+};
+
+// 8-connected component labeling, returns compact label for each run (segments[i].val == i + 1),
+// numbered in raster scan order of segment first pixel.
+std::vector<uint32_t> LabelRuns(const RunRaster& raster, std::vector<Segment>& segments);
+// Same with labels painted to per-pixel raster, 0 is background.
+void LabelComponents(const RunRaster& raster, std::vector<uint32_t>& labels, std::vector<Segment>& segments);
@@ -0,0 +1,104 @@
+#include "WorkerPool.h"
+
+#include <ErrorHandling.h>
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(size_t threadCount, size_t queueCapacity) :
+	queue_(queueCapacity),
+	submitted_(0),
+	completedPrefix_(0),
+	failedSequence_(0)
+{
+	threadCount = std::max<size_t>(1, threadCount);
+	for (size_t i = 0; i < threadCount; ++i)
+	{
+		threads_.emplace_back([this]() { WorkerLoop(); });
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	queue_.Close();
+	for (auto& t : threads_)
+	{
+		t.join();
+	}
+}
+
+uint64_t WorkerPool::Submit(Task task)
+{
+	uint64_t sequence = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		RethrowFailure();
+		sequence = submitted_++;
+		done_.push_back(false);
+	}
+
+	CHECK_EX(queue_.Push(QueuedTask{ sequence, std::move(task) }), "Worker pool is stopped");
+	return sequence;
+}
+
+void WorkerPool::Wait()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	completed_.wait(lock, [this]() { return completedPrefix_ == submitted_; });
+	RethrowFailure();
+}
+
+uint64_t WorkerPool::GetCompletedCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return completedPrefix_;
+}
+
+void WorkerPool::WorkerLoop()
+{
+	QueuedTask queued;
+	while (queue_.Pop(queued))
+	{
+		std::exception_ptr error;
+		try
+		{
+			queued.task();
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+		queued.task = nullptr;
+		Complete(queued.sequence, error);
+	}
+}
+
+void WorkerPool::Complete(uint64_t sequence, std::exception_ptr error)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (error && (!failure_ || sequence < failedSequence_))
+		{
+			failure_ = error;
+			failedSequence_ = sequence;
+		}
+
+		done_[sequence - completedPrefix_] = true;
+		while (!done_.empty() && done_.front())
+		{
+			done_.pop_front();
+			++completedPrefix_;
+		}
+	}
+	completed_.notify_all();
+}
+
+// mutex_ must be held
+void WorkerPool::RethrowFailure()
+{
+	if (failure_)
+	{
+		auto error = failure_;
+		failure_ = nullptr;
+		std::rethrow_exception(error);
+	}
+}
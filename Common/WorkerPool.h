@@ -0,0 +1,56 @@
+#pragma once
+
+#include "BoundedQueue.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads fed by bounded queue. Submit blocks while queue is full,
+// so producer is throttled to workers' speed instead of spawning more threads.
+class WorkerPool
+{
+public:
+	using Task = std::function<void()>;
+
+	WorkerPool(size_t threadCount, size_t queueCapacity);
+	// finishes queued tasks, failures are dropped (call Wait to observe them)
+	~WorkerPool();
+
+	// Returns sequence number of task. Rethrows failure of earlier task, if any.
+	uint64_t Submit(Task task);
+	// Waits until all submitted tasks are done, rethrows first failed one in submission order.
+	void Wait();
+
+	// tasks [0, result) are all done
+	uint64_t GetCompletedCount() const;
+	size_t GetThreadCount() const { return threads_.size(); }
+
+private:
+	struct QueuedTask
+	{
+		uint64_t sequence;
+		Task task;
+	};
+
+	void WorkerLoop();
+	void Complete(uint64_t sequence, std::exception_ptr error);
+	void RethrowFailure();
+
+	BoundedQueue<QueuedTask> queue_;
+	std::vector<std::thread> threads_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable completed_;
+	uint64_t submitted_;
+	uint64_t completedPrefix_;
+	// done flags of tasks after completedPrefix_
+	std::deque<bool> done_;
+	uint64_t failedSequence_;
+	std::exception_ptr failure_;
+};
@@ -0,0 +1,193 @@
+#include "ZipWriter.h"
+
+#include <ErrorHandling.h>
+
+#include <zlib.h>
+
+#include <ctime>
+#include <limits>
+
+#include <boost/filesystem.hpp>
+
+namespace
+{
+	const uint32_t LocalHeaderSignature = 0x04034b50;
+	const uint32_t CentralHeaderSignature = 0x02014b50;
+	const uint32_t EndOfCentralDirectorySignature = 0x06054b50;
+	const uint32_t Zip64EndOfCentralDirectorySignature = 0x06064b50;
+	const uint32_t Zip64LocatorSignature = 0x07064b50;
+	const uint16_t Zip64ExtraId = 0x0001;
+	const uint16_t VersionStored = 10;
+	const uint16_t VersionZip64 = 45;
+	// names are UTF-8
+	const uint16_t Utf8Flag = 1 << 11;
+	const uint16_t MethodStored = 0;
+	const uint32_t Max32 = std::numeric_limits<uint32_t>::max();
+	const uint16_t Max16 = std::numeric_limits<uint16_t>::max();
+
+	void Put16(std::vector<uint8_t>& out, uint16_t v)
+	{
+		out.push_back(static_cast<uint8_t>(v));
+		out.push_back(static_cast<uint8_t>(v >> 8));
+	}
+
+	void Put32(std::vector<uint8_t>& out, uint32_t v)
+	{
+		Put16(out, static_cast<uint16_t>(v));
+		Put16(out, static_cast<uint16_t>(v >> 16));
+	}
+
+	void Put64(std::vector<uint8_t>& out, uint64_t v)
+	{
+		Put32(out, static_cast<uint32_t>(v));
+		Put32(out, static_cast<uint32_t>(v >> 32));
+	}
+} //namespace
+
+ZipWriter::ZipWriter(const std::string& fileName) :
+	fileName_(fileName),
+	tempFileName_(fileName + ".tmp"),
+	file_(tempFileName_, std::ios::binary | std::ios::trunc),
+	offset_(0),
+	dosTime_(0),
+	dosDate_(0),
+	finished_(false)
+{
+	CHECK_EX(file_, "Can't create archive");
+
+	const auto now = std::time(nullptr);
+	const auto local = *std::localtime(&now);
+	dosTime_ = static_cast<uint16_t>(local.tm_hour << 11 | local.tm_min << 5 | local.tm_sec / 2);
+	dosDate_ = static_cast<uint16_t>((local.tm_year - 80) << 9 | (local.tm_mon + 1) << 5 | local.tm_mday);
+}
+
+ZipWriter::~ZipWriter()
+{
+	if (!finished_)
+	{
+		file_.close();
+		boost::system::error_code error;
+		boost::filesystem::remove(tempFileName_, error);
+	}
+}
+
+void ZipWriter::Add(const std::string& name, const void* data, size_t size)
+{
+	CHECK_EX(name.size() < Max16, "Archive entry name is too long");
+	CHECK_EX(size < Max32, "Archive entry is too large");
+
+	Entry entry;
+	entry.name = name;
+	entry.crc = static_cast<uint32_t>(crc32(0, static_cast<const Bytef*>(data), static_cast<uInt>(size)));
+	entry.size = size;
+
+	// sizes are known, so entry needs no data descriptor
+	std::vector<uint8_t> header;
+	Put32(header, LocalHeaderSignature);
+	Put16(header, VersionStored);
+	Put16(header, Utf8Flag);
+	Put16(header, MethodStored);
+	Put16(header, dosTime_);
+	Put16(header, dosDate_);
+	Put32(header, entry.crc);
+	Put32(header, static_cast<uint32_t>(size));
+	Put32(header, static_cast<uint32_t>(size));
+	Put16(header, static_cast<uint16_t>(name.size()));
+	Put16(header, 0);
+	header.insert(header.end(), name.begin(), name.end());
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	CHECK_EX(!finished_, "Archive is finished");
+	entry.offset = offset_;
+	Write(header);
+	file_.write(static_cast<const char*>(data), size);
+	CHECK_EX(file_, "Can't write archive");
+	offset_ += size;
+	entries_.push_back(entry);
+}
+
+void ZipWriter::Finish()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	CHECK_EX(!finished_, "Archive is finished");
+
+	const auto directoryOffset = offset_;
+	for (const auto& entry : entries_)
+	{
+		const auto zip64 = entry.offset >= Max32;
+		std::vector<uint8_t> header;
+		Put32(header, CentralHeaderSignature);
+		Put16(header, zip64 ? VersionZip64 : VersionStored);
+		Put16(header, zip64 ? VersionZip64 : VersionStored);
+		Put16(header, Utf8Flag);
+		Put16(header, MethodStored);
+		Put16(header, dosTime_);
+		Put16(header, dosDate_);
+		Put32(header, entry.crc);
+		Put32(header, static_cast<uint32_t>(entry.size));
+		Put32(header, static_cast<uint32_t>(entry.size));
+		Put16(header, static_cast<uint16_t>(entry.name.size()));
+		Put16(header, zip64 ? 12 : 0);
+		// comment length, disk, internal and external attributes
+		Put16(header, 0);
+		Put16(header, 0);
+		Put16(header, 0);
+		Put32(header, 0);
+		Put32(header, zip64 ? Max32 : static_cast<uint32_t>(entry.offset));
+		header.insert(header.end(), entry.name.begin(), entry.name.end());
+		if (zip64)
+		{
+			Put16(header, Zip64ExtraId);
+			Put16(header, 8);
+			Put64(header, entry.offset);
+		}
+		Write(header);
+	}
+	const auto directorySize = offset_ - directoryOffset;
+
+	std::vector<uint8_t> end;
+	const auto zip64 = entries_.size() >= Max16 || directoryOffset >= Max32 || directorySize >= Max32;
+	if (zip64)
+	{
+		const auto recordOffset = offset_;
+		Put32(end, Zip64EndOfCentralDirectorySignature);
+		// size of remaining record
+		Put64(end, 44);
+		Put16(end, VersionZip64);
+		Put16(end, VersionZip64);
+		Put32(end, 0);
+		Put32(end, 0);
+		Put64(end, entries_.size());
+		Put64(end, entries_.size());
+		Put64(end, directorySize);
+		Put64(end, directoryOffset);
+
+		Put32(end, Zip64LocatorSignature);
+		Put32(end, 0);
+		Put64(end, recordOffset);
+		Put32(end, 1);
+	}
+	Put32(end, EndOfCentralDirectorySignature);
+	Put16(end, 0);
+	Put16(end, 0);
+	Put16(end, zip64 ? Max16 : static_cast<uint16_t>(entries_.size()));
+	Put16(end, zip64 ? Max16 : static_cast<uint16_t>(entries_.size()));
+	Put32(end, zip64 ? Max32 : static_cast<uint32_t>(directorySize));
+	Put32(end, zip64 ? Max32 : static_cast<uint32_t>(directoryOffset));
+	Put16(end, 0);
+	Write(end);
+
+	file_.close();
+	CHECK_EX(file_, "Can't write archive");
+	// replaces existing archive
+	boost::filesystem::rename(tempFileName_, fileName_);
+	finished_ = true;
+}
+
+// mutex_ must be held
+void ZipWriter::Write(const std::vector<uint8_t>& bytes)
+{
+	file_.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+	CHECK_EX(file_, "Can't write archive");
+	offset_ += bytes.size();
+}
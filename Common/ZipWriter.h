@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Streams stored (uncompressed) entries into ZIP file, central directory is written by Finish.
+// Archive is written to temporary file and renamed by Finish, so fileName never has partial archive.
+// ZIP64 records are added when archive exceeds 4 GB or 65535 entries.
+class ZipWriter
+{
+public:
+	explicit ZipWriter(const std::string& fileName);
+	// removes unfinished archive
+	~ZipWriter();
+
+	// thread-safe, entries keep order of calls
+	void Add(const std::string& name, const void* data, size_t size);
+	void Finish();
+
+private:
+	struct Entry
+	{
+		std::string name;
+		uint32_t crc;
+		uint64_t size;
+		uint64_t offset;
+	};
+
+	void Write(const std::vector<uint8_t>& bytes);
+
+	const std::string fileName_;
+	const std::string tempFileName_;
+	std::mutex mutex_;
+	std::ofstream file_;
+	uint64_t offset_;
+	uint16_t dosTime_;
+	uint16_t dosDate_;
+	std::vector<Entry> entries_;
+	bool finished_;
+};
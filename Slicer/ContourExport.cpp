@@ -0,0 +1,210 @@
+#include "ContourExport.h"
+#include "Renderer.h"
+#include "Utils.h"
+
+#include <Contours.h>
+#include <Loaders.h>
+#include <WorkerPool.h>
+#include <PerfTimer.h>
+#include <ErrorHandling.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/log/trivial.hpp>
+
+namespace
+{
+	// slices cut in parallel before CLI output of them is written
+	const uint32_t SlicesPerThreadInBatch = 16;
+	// 0.1 um
+	const int CoordinateDecimals = 4;
+
+	// CLI polyline directions
+	const int Clockwise = 0;
+	const int CounterClockwise = 1;
+
+	// model centered on plate like in rendered images
+	struct PlateTransform
+	{
+		glm::vec2 Apply(const glm::vec2& p) const
+		{
+			auto result = p - center + plateSize * 0.5f;
+			if (mirrorX)
+			{
+				result.x = plateSize.x - result.x;
+			}
+			if (mirrorY)
+			{
+				result.y = plateSize.y - result.y;
+			}
+			return result;
+		}
+
+		glm::vec2 center;
+		glm::vec2 plateSize;
+		bool mirrorX;
+		bool mirrorY;
+	};
+
+	float GetSignedArea(const Contour& contour)
+	{
+		float area = 0.0f;
+		for (size_t i = 0, j = contour.size() - 1; i < contour.size(); j = i++)
+		{
+			area += contour[j].x * contour[i].y - contour[i].x * contour[j].y;
+		}
+		return area * 0.5f;
+	}
+
+	// white solid on black plate, y axis points down in SVG
+	std::string FormatSvg(const std::vector<Contour>& contours, const glm::vec2& plateSize)
+	{
+		std::stringstream s;
+		s << std::fixed << std::setprecision(CoordinateDecimals);
+		s << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+		s << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << plateSize.x << "mm\" height=\"" << plateSize.y <<
+			"mm\" viewBox=\"0 0 " << plateSize.x << " " << plateSize.y << "\">\n";
+		s << "<rect width=\"100%\" height=\"100%\" fill=\"black\"/>\n";
+		s << "<path fill=\"white\" fill-rule=\"evenodd\" d=\"";
+		for (const auto& contour : contours)
+		{
+			for (size_t i = 0; i < contour.size(); ++i)
+			{
+				s << (i == 0 ? "M" : "L") << contour[i].x << " " << (plateSize.y - contour[i].y) << " ";
+			}
+			s << "Z ";
+		}
+		s << "\"/>\n</svg>\n";
+		return s.str();
+	}
+
+	// closed polylines repeat first point
+	std::string FormatCliLayer(const std::vector<Contour>& contours, float height)
+	{
+		std::stringstream s;
+		s << std::fixed << std::setprecision(CoordinateDecimals);
+		s << "$$LAYER/" << height << "\n";
+		for (const auto& contour : contours)
+		{
+			const auto direction = GetSignedArea(contour) > 0.0f ? CounterClockwise : Clockwise;
+			s << "$$POLYLINE/1," << direction << "," << contour.size() + 1;
+			for (size_t i = 0; i <= contour.size(); ++i)
+			{
+				const auto& p = contour[i % contour.size()];
+				s << "," << p.x << "," << p.y;
+			}
+			s << "\n";
+		}
+		return s.str();
+	}
+} //namespace
+
+uint32_t ExportContours(const Settings& settings)
+{
+	PerfTimer exportTime("Export contours");
+
+	std::vector<float> vb;
+	std::vector<uint32_t> ib;
+	LoadMesh(settings.modelFile, vb, ib);
+	const MeshSlicer slicer(vb, ib);
+
+	PlateTransform transform;
+	transform.center = glm::vec2(slicer.GetMin() + slicer.GetMax()) * 0.5f;
+	transform.plateSize = glm::vec2(settings.plateWidth, settings.plateHeight);
+	transform.mirrorX = settings.mirrorX;
+	transform.mirrorY = settings.mirrorY;
+
+	// same slice heights as Renderer::GetSlicePosition
+	const auto getSlicePosition = [&](uint32_t slice) { return slicer.GetMin().z + settings.step / 2 + slice * settings.step; };
+	uint32_t sliceCount = 0;
+	while (getSlicePosition(sliceCount) < slicer.GetMax().z)
+	{
+		++sliceCount;
+	}
+
+	const auto cli = boost::algorithm::iends_with(settings.contours, ".cli");
+	const auto tempFileName = settings.contours + ".tmp";
+	std::ofstream cliFile;
+	if (cli)
+	{
+		cliFile.open(tempFileName, std::ios::binary | std::ios::trunc);
+		CHECK_EX(cliFile, "Can't create contour file");
+		cliFile << "$$HEADERSTART\n$$ASCII\n$$UNITS/1.0\n$$VERSION/200\n$$LAYERS/" << sliceCount << "\n$$HEADEREND\n";
+		cliFile << "$$GEOMETRYSTART\n";
+	}
+	else
+	{
+		boost::filesystem::create_directories(settings.contours);
+	}
+
+	const auto threads = std::max(1u, std::thread::hardware_concurrency());
+	const auto batchSize = threads * SlicesPerThreadInBatch;
+	WorkerPool pool(threads, batchSize);
+	std::atomic<uint32_t> openChains(0);
+	std::vector<std::string> batch(batchSize);
+	for (uint32_t first = 0; first < sliceCount; first += batchSize)
+	{
+		const auto count = std::min(batchSize, sliceCount - first);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			pool.Submit([&, i]() {
+				const auto slice = first + i;
+				uint32_t open = 0;
+				auto contours = slicer.Slice(getSlicePosition(slice), &open);
+				openChains += open;
+				for (auto& contour : contours)
+				{
+					std::transform(contour.begin(), contour.end(), contour.begin(), [&](const glm::vec2& p) { return transform.Apply(p); });
+					// single mirror flips orientation, solids stay counter-clockwise
+					if (transform.mirrorX != transform.mirrorY)
+					{
+						std::reverse(contour.begin(), contour.end());
+					}
+				}
+
+				if (cli)
+				{
+					// layer top above platform
+					batch[i] = FormatCliLayer(contours, (slice + 1) * settings.step);
+				}
+				else
+				{
+					const auto svg = FormatSvg(contours, transform.plateSize);
+					const auto fileName = boost::filesystem::path(settings.contours) /
+						boost::filesystem::path(GetOutputFileName(settings, slice)).replace_extension(".svg");
+					WriteFileAtomically(fileName.string(), svg.data(), svg.size());
+				}
+			});
+		}
+		pool.Wait();
+
+		for (uint32_t i = 0; cli && i < count; ++i)
+		{
+			cliFile << batch[i];
+			batch[i].clear();
+		}
+	}
+
+	if (cli)
+	{
+		cliFile << "$$GEOMETRYEND\n";
+		cliFile.close();
+		CHECK_EX(cliFile, "Can't write contour file");
+		// replaces existing file
+		boost::filesystem::rename(tempFileName, settings.contours);
+	}
+
+	if (openChains > 0)
+	{
+		BOOST_LOG_TRIVIAL(warning) << "Mesh is not closed, open contour chains dropped: " << openChains;
+	}
+	BOOST_LOG_TRIVIAL(info) << "Contour slices: " << sliceCount;
+	return sliceCount;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstdint>
+
+struct Settings;
+
+// Writes slice contours cut from mesh without rendering: Common Layer Interface file if settings.contours ends with
+// ".cli", SVG file per slice in settings.contours directory otherwise. Slices have same heights as rendered ones,
+// coordinates are plate millimeters with model centered and mirrored like in images. Returns number of slices.
+uint32_t ExportContours(const Settings& settings);
@@ -4,7 +4,8 @@
 #include "Renderer.h"
 
 #include <fstream>
-#include <codecvt>
+#include <string>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 
@@ -24,81 +25,272 @@ std::string ReadEnvisiontechTemplate(const std::string& path)
 	return result;
 }
 
-std::string ProcessLayerTemplate(const std::string & layerTemplate, const Settings & settings, uint32_t layerNumber)
+namespace
 {
-	const auto layerFileName = GetOutputFileName(settings, layerNumber);
+	enum class Placeholder
+	{
+		FileName,
+		LayerNumber,
+		LayerStep,
+		TotalLayers,
+		BaseLayersCount,
+		XRes,
+		YRes,
+		PlatformWidthMicrons,
+		PlatformHeightMicrons,
+		BaseLayer,
+		FirstLayer,
+		Layers,
+		// literal text
+		None
+	};
 
-	std::string result;
-	result = ReplaceAll(layerTemplate, "#FILENAME#", layerFileName);
-	result = ReplaceAll(result, "#LAYER_NUMBER#", std::to_string(layerNumber));
-	result = ReplaceAll(result, "#LAYER_STEP#", std::to_string(static_cast<uint32_t>(settings.step * 1000)));
+	const char* const PlaceholderNames[] = { "FILENAME", "LAYER_NUMBER", "LAYER_STEP", "TOTAL_LAYERS", "BASE_LAYERS_COUNT",
+		"X_RES", "Y_RES", "PLATFORM_WIDTH_MICRONS", "PLATFORM_HEIGHT_MICRONS", "BASE_LAYER", "FIRST_LAYER", "LAYERS" };
+	static_assert(sizeof(PlaceholderNames) / sizeof(PlaceholderNames[0]) == static_cast<size_t>(Placeholder::None),
+		"Name of each placeholder is needed");
 
-	return result;
-}
+	// ASCII values (numbers, file names)
+	void AppendAscii(std::u16string& out, const std::string& text)
+	{
+		out.append(text.begin(), text.end());
+	}
 
-std::string GenLayerConfig(const std::string & layerTemplate, const std::string & layerTemplateERM, const Settings & settings, bool isBaseLayer, uint32_t & layerNumber)
-{
-	auto result = ProcessLayerTemplate(layerTemplate, settings, layerNumber);
-	++layerNumber;
+	// placeholder which has no value in template is kept as text
+	void AppendPlaceholderText(std::u16string& out, Placeholder placeholder)
+	{
+		out.push_back(u'#');
+		AppendAscii(out, PlaceholderNames[static_cast<size_t>(placeholder)]);
+		out.push_back(u'#');
+	}
 
-	if (settings.enableERM && !isBaseLayer)
+	void AppendUtf16(std::u16string& out, const std::string& utf8)
 	{
-		result += ProcessLayerTemplate(layerTemplateERM, settings, layerNumber);
-		++layerNumber;
+		for (size_t i = 0; i < utf8.size();)
+		{
+			const auto lead = static_cast<uint8_t>(utf8[i]);
+			const auto length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : (lead >> 3) == 0x1E ? 4 : 0;
+			CHECK_EX(length > 0 && i + length <= utf8.size(), "Template is not UTF-8 text");
+			uint32_t codePoint = length == 1 ? lead : lead & (0xFF >> (length + 1));
+			for (auto k = 1; k < length; ++k)
+			{
+				const auto next = static_cast<uint8_t>(utf8[i + k]);
+				CHECK_EX((next & 0xC0) == 0x80, "Template is not UTF-8 text");
+				codePoint = codePoint << 6 | (next & 0x3F);
+			}
+			CHECK_EX(codePoint <= 0x10FFFF, "Template is not UTF-8 text");
+			if (codePoint < 0x10000)
+			{
+				out.push_back(static_cast<char16_t>(codePoint));
+			}
+			else
+			{
+				codePoint -= 0x10000;
+				out.push_back(static_cast<char16_t>(0xD800 | codePoint >> 10));
+				out.push_back(static_cast<char16_t>(0xDC00 | (codePoint & 0x3FF)));
+			}
+			i += length;
+		}
 	}
 
-	return result;
-}
+	// Text with #NAME# placeholders, parsed once and rendered in single pass straight into UTF-16 output.
+	// Unknown #NAME# is kept as text.
+	class ConfigTemplate
+	{
+	public:
+		explicit ConfigTemplate(const std::string& utf8)
+		{
+			std::string literal;
+			const auto flushLiteral = [this, &literal]() {
+				if (!literal.empty())
+				{
+					const auto offset = text_.size();
+					AppendUtf16(text_, literal);
+					tokens_.push_back(Token{ Placeholder::None, offset, text_.size() - offset });
+					literal.clear();
+				}
+			};
+			for (size_t pos = 0; pos < utf8.size();)
+			{
+				const auto end = utf8[pos] == '#' ? utf8.find('#', pos + 1) : std::string::npos;
+				const auto placeholder = end == std::string::npos ? Placeholder::None : Find(utf8.substr(pos + 1, end - pos - 1));
+				if (placeholder == Placeholder::None)
+				{
+					literal.push_back(utf8[pos++]);
+					continue;
+				}
+				flushLiteral();
+				tokens_.push_back(Token{ placeholder, 0, 0 });
+				pos = end + 1;
+			}
+			flushLiteral();
+		}
 
-void WriteEnvisiontechConfig(const Settings & settings, const std::string & fileName, uint32_t numSlices)
-{
-	const auto jobTemplate = ReadEnvisiontechTemplate(
-		(boost::filesystem::path(settings.envisiontechTemplatesPath) / "job_template.txt").string());
-	const auto baseLayerTemplate = ReadEnvisiontechTemplate(
-		(boost::filesystem::path(settings.envisiontechTemplatesPath) / "base_layer_template.txt").string());
-	const auto firstLayerTemplate = ReadEnvisiontechTemplate(
-		(boost::filesystem::path(settings.envisiontechTemplatesPath) / "first_layer_template.txt").string());
-	const auto firstLayerErmTemplate = ReadEnvisiontechTemplate(
-		(boost::filesystem::path(settings.envisiontechTemplatesPath) / "first_layer_template_erm_part.txt").string());
-	const auto layerTemplate = ReadEnvisiontechTemplate(
-		(boost::filesystem::path(settings.envisiontechTemplatesPath) / "layer_template.txt").string());
-	const auto layerErmTemplate = ReadEnvisiontechTemplate(
-		(boost::filesystem::path(settings.envisiontechTemplatesPath) / "layer_template_erm_part.txt").string());
+		// UTF-16 length without placeholders
+		size_t GetTextLength() const
+		{
+			return text_.size();
+		}
 
-	uint32_t layerNumber = 0;
-	std::string baseLayers;
-	for (size_t i = 0; i < settings.whiteLayers; ++i)
-	{
-		baseLayers += GenLayerConfig(baseLayerTemplate, baseLayerTemplate, settings, true, layerNumber);
-	}
-	
-	auto firstLayer(numSlices > 0 ? GenLayerConfig(firstLayerTemplate, firstLayerErmTemplate, settings, false, layerNumber) : std::string());
+		// appendValue(placeholder, out) appends value of placeholder
+		template <typename AppendValue>
+		void Render(std::u16string& out, const AppendValue& appendValue) const
+		{
+			for (const auto& token : tokens_)
+			{
+				if (token.placeholder == Placeholder::None)
+				{
+					out.append(text_, token.offset, token.length);
+				}
+				else
+				{
+					appendValue(token.placeholder, out);
+				}
+			}
+		}
 
-	std::string layers;
-	for (uint32_t slice = 0; slice < (numSlices > 0 ? (numSlices-1) : 0); ++slice)
+	private:
+		struct Token
+		{
+			Placeholder placeholder;
+			// literal in text_
+			size_t offset;
+			size_t length;
+		};
+
+		static Placeholder Find(const std::string& name)
+		{
+			for (size_t i = 0; i < static_cast<size_t>(Placeholder::None); ++i)
+			{
+				if (name == PlaceholderNames[i])
+				{
+					return static_cast<Placeholder>(i);
+				}
+			}
+			return Placeholder::None;
+		}
+
+		std::u16string text_;
+		std::vector<Token> tokens_;
+	};
+
+	ConfigTemplate LoadTemplate(const Settings& settings, const char* name)
 	{
-		layers += GenLayerConfig(layerTemplate, layerErmTemplate, settings, false, layerNumber);
+		return ConfigTemplate(ReadEnvisiontechTemplate((boost::filesystem::path(settings.envisiontechTemplatesPath) / name).string()));
 	}
+} //namespace
 
-	auto job = jobTemplate;
-	job = ReplaceAll(job, "#TOTAL_LAYERS#", std::to_string(numSlices * (settings.enableERM ? 2 : 1) + settings.whiteLayers));
-	job = ReplaceAll(job, "#BASE_LAYERS_COUNT#", std::to_string(settings.whiteLayers));
-	job = ReplaceAll(job, "#X_RES#", std::to_string(settings.renderWidth));
-	job = ReplaceAll(job, "#Y_RES#", std::to_string(settings.renderHeight));
-	job = ReplaceAll(job, "#PLATFORM_WIDTH_MICRONS#", std::to_string(static_cast<uint32_t>(settings.plateWidth * 1000)));
-	job = ReplaceAll(job, "#PLATFORM_HEIGHT_MICRONS#", std::to_string(static_cast<uint32_t>(settings.plateHeight * 1000)));
-	job = ReplaceAll(job, "#BASE_LAYER#", baseLayers);
-	job = ReplaceAll(job, "#FIRST_LAYER#", firstLayer);
-	job = ReplaceAll(job, "#LAYERS#", layers);
+std::string GenerateEnvisiontechConfig(const Settings & settings, uint32_t numSlices)
+{
+	const auto jobTemplate = LoadTemplate(settings, "job_template.txt");
+	const auto baseLayerTemplate = LoadTemplate(settings, "base_layer_template.txt");
+	const auto firstLayerTemplate = LoadTemplate(settings, "first_layer_template.txt");
+	const auto firstLayerErmTemplate = LoadTemplate(settings, "first_layer_template_erm_part.txt");
+	const auto layerTemplate = LoadTemplate(settings, "layer_template.txt");
+	const auto layerErmTemplate = LoadTemplate(settings, "layer_template_erm_part.txt");
 
-	std::wstring_convert<std::codecvt_utf8_utf16<unsigned short>, unsigned short> convert;
-	std::basic_string<unsigned short> out = convert.from_bytes(job);
+	const auto layerStep = std::to_string(static_cast<uint32_t>(settings.step * 1000));
+	uint32_t layerNumber = 0;
+	const auto appendLayer = [&](const ConfigTemplate& layer, std::u16string& out) {
+		layer.Render(out, [&](Placeholder placeholder, std::u16string& out) {
+			switch (placeholder)
+			{
+			case Placeholder::FileName:
+				AppendAscii(out, GetOutputFileName(settings, layerNumber));
+				break;
+			case Placeholder::LayerNumber:
+				AppendAscii(out, std::to_string(layerNumber));
+				break;
+			case Placeholder::LayerStep:
+				AppendAscii(out, layerStep);
+				break;
+			default:
+				AppendPlaceholderText(out, placeholder);
+			}
+		});
+		++layerNumber;
+	};
+	const auto appendSlice = [&](const ConfigTemplate& layer, const ConfigTemplate& ermLayer, std::u16string& out) {
+		appendLayer(layer, out);
+		if (settings.enableERM)
+		{
+			appendLayer(ermLayer, out);
+		}
+	};
 
-	std::fstream file((boost::filesystem::path(settings.outputDir) / fileName).string(), std::ios::out | std::ios::binary);
-	CHECK(file.good());
+	const auto slicesAfterFirst = numSlices > 0 ? numSlices - 1 : 0;
+	const auto appendJobValue = [&](Placeholder placeholder, std::u16string& out) {
+		switch (placeholder)
+		{
+		case Placeholder::TotalLayers:
+			AppendAscii(out, std::to_string(numSlices * (settings.enableERM ? 2 : 1) + settings.whiteLayers));
+			break;
+		case Placeholder::BaseLayersCount:
+			AppendAscii(out, std::to_string(settings.whiteLayers));
+			break;
+		case Placeholder::XRes:
+			AppendAscii(out, std::to_string(settings.renderWidth));
+			break;
+		case Placeholder::YRes:
+			AppendAscii(out, std::to_string(settings.renderHeight));
+			break;
+		case Placeholder::PlatformWidthMicrons:
+			AppendAscii(out, std::to_string(static_cast<uint32_t>(settings.plateWidth * 1000)));
+			break;
+		case Placeholder::PlatformHeightMicrons:
+			AppendAscii(out, std::to_string(static_cast<uint32_t>(settings.plateHeight * 1000)));
+			break;
+		// layers are numbered in order of sections, whatever their order in job template
+		case Placeholder::BaseLayer:
+			layerNumber = 0;
+			for (uint32_t i = 0; i < settings.whiteLayers; ++i)
+			{
+				appendLayer(baseLayerTemplate, out);
+			}
+			break;
+		case Placeholder::FirstLayer:
+			layerNumber = settings.whiteLayers;
+			if (numSlices > 0)
+			{
+				appendSlice(firstLayerTemplate, firstLayerErmTemplate, out);
+			}
+			break;
+		case Placeholder::Layers:
+			layerNumber = settings.whiteLayers + (numSlices > 0 ? (settings.enableERM ? 2 : 1) : 0);
+			for (uint32_t slice = 0; slice < slicesAfterFirst; ++slice)
+			{
+				appendSlice(layerTemplate, layerErmTemplate, out);
+			}
+			break;
+		default:
+			AppendPlaceholderText(out, placeholder);
+			break;
+		}
+	};
+
+	// numbers in layer templates are short, so this is close to final size
+	const size_t NumbersLength = 32;
+	const auto sliceLength = [&](const ConfigTemplate& layer, const ConfigTemplate& ermLayer) {
+		return layer.GetTextLength() + NumbersLength + (settings.enableERM ? ermLayer.GetTextLength() + NumbersLength : 0);
+	};
+	std::u16string out;
+	out.reserve(1 + jobTemplate.GetTextLength() + settings.whiteLayers * (baseLayerTemplate.GetTextLength() + NumbersLength) +
+		sliceLength(firstLayerTemplate, firstLayerErmTemplate) + slicesAfterFirst * sliceLength(layerTemplate, layerErmTemplate));
 
 	const char16_t ByteOrderMark = 0xFEFF;
-	file.write(reinterpret_cast<const char*>(&ByteOrderMark), sizeof(ByteOrderMark));
-	file.write(reinterpret_cast<const char*>(out.c_str()), out.length() * sizeof(out[0]));
+	out.push_back(ByteOrderMark);
+	jobTemplate.Render(out, appendJobValue);
+
+	// UTF-16 in byte order of machine
+	return std::string(reinterpret_cast<const char*>(out.data()), out.size() * sizeof(out[0]));
+}
+
+void WriteEnvisiontechConfig(const Settings & settings, const std::string & fileName, uint32_t numSlices)
+{
+	const auto config = GenerateEnvisiontechConfig(settings, numSlices);
+
+	std::fstream file((boost::filesystem::path(settings.outputDir) / fileName).string(), std::ios::out | std::ios::binary);
+	CHECK(file.good());
+	file.write(config.data(), config.size());
 	CHECK(file.good());
 }
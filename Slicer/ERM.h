@@ -3,4 +3,6 @@
 #include <cstdint>
 
 struct Settings;
+// UTF-16 job config with byte order mark
+std::string GenerateEnvisiontechConfig(const Settings& settings, uint32_t numSlices);
 void WriteEnvisiontechConfig(const Settings& settings, const std::string& fileName, uint32_t numSlices);
\ No newline at end of file
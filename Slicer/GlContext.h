@@ -12,14 +12,22 @@ struct IGlContext
 {
 	virtual uint32_t GetSurfaceWidth() const = 0;
 	virtual uint32_t GetSurfaceHeight() const = 0;
+	// re-creates render targets for new size, keeps programs, textures and buffers
+	virtual void Resize(uint32_t width, uint32_t height) = 0;
 
 	virtual std::vector<uint8_t> GetRaster() = 0;
+	// writes surface width * height bytes
+	virtual void ReadRaster(uint8_t* raster) = 0;
 	virtual void SetRaster(const std::vector<uint8_t>& raster, uint32_t width, uint32_t height) = 0;
 
 	virtual void SwapBuffers() = 0;
+	// context is current on one thread at a time, constructor makes it current on creating thread
+	virtual void MakeCurrent() = 0;
+	virtual void ReleaseCurrent() = 0;
 	virtual void ResetFBO() = 0;
 
 	virtual void CreateTextureFBO(GLFramebuffer& fbo, GLTexture& texture) = 0;
+	virtual void CreateTextureFBO(uint32_t width, uint32_t height, GLFramebuffer& fbo, GLTexture& texture) = 0;
 	virtual void Resolve(const GLFramebuffer& fboTo) = 0;
 
 	virtual ~IGlContext() {}
@@ -41,4 +49,6 @@ private:
 };
 
 std::unique_ptr<IGlContext> CreateFullscreenGlContext(uint32_t width, uint32_t height, uint32_t samples);
-std::unique_ptr<IGlContext> CreateOffscreenGlContext(uint32_t width, uint32_t height, uint32_t samples);
\ No newline at end of file
+std::unique_ptr<IGlContext> CreateOffscreenGlContext(uint32_t width, uint32_t height, uint32_t samples);
+// same sized offscreen context sharing buffers, textures and programs with shareContext
+std::unique_ptr<IGlContext> CreateSharedOffscreenGlContext(IGlContext& shareContext);
\ No newline at end of file
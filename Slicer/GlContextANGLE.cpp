@@ -16,43 +16,54 @@ namespace
 	void CheckRequiredGLExtensions();
 }
 
-GlContextANGLE::GlContextANGLE(uint32_t width, uint32_t height, uint32_t samples) :
+GlContextANGLE::GlContextANGLE(uint32_t width, uint32_t height, uint32_t samples, GlContextANGLE* shareContext) :
 width_(width),
-height_(height)
+height_(height),
+samples_(samples),
+inShareGroup_(shareContext != nullptr)
 {
 	if (width == 0 || height == 0)
 	{
 		throw std::runtime_error("Invalid render target size");
 	}
 
-	gl_.display = eglGetDisplay(EGL_D3D11_ONLY_DISPLAY_ANGLE);
-	if (!gl_.display)
+	if (shareContext)
 	{
-		throw std::runtime_error("Can't get egl display");
+		shareContext->inShareGroup_ = true;
+		gl_.display = shareContext->gl_.display;
+		gl_.ownsDisplay = false;
+		gl_.config = shareContext->gl_.config;
 	}
-
-	if (!eglInitialize(gl_.display, nullptr, nullptr))
+	else
 	{
-		throw std::runtime_error("Can't initialize egl");
-	}
+		gl_.display = eglGetDisplay(EGL_D3D11_ONLY_DISPLAY_ANGLE);
+		if (!gl_.display)
+		{
+			throw std::runtime_error("Can't get egl display");
+		}
 
-	CheckRequiredEGLExtensions(gl_.display);
+		if (!eglInitialize(gl_.display, nullptr, nullptr))
+		{
+			throw std::runtime_error("Can't initialize egl");
+		}
 
-	EGLint const attributeList[] =
-	{
-		EGL_RED_SIZE, 8,
-		EGL_GREEN_SIZE, 8,
-		EGL_BLUE_SIZE, 8,
-		EGL_ALPHA_SIZE, 8,
-		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
-		EGL_NONE
-	};
+		CheckRequiredEGLExtensions(gl_.display);
 
-	EGLConfig config;
-	EGLint numConfig;
-	if (!eglChooseConfig(gl_.display, attributeList, &config, 1, &numConfig) || numConfig == 0)
-	{
-		throw std::runtime_error("Can't find gl config (check if requested samples count supported)");
+		EGLint const attributeList[] =
+		{
+			EGL_RED_SIZE, 8,
+			EGL_GREEN_SIZE, 8,
+			EGL_BLUE_SIZE, 8,
+			EGL_ALPHA_SIZE, 8,
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_NONE
+		};
+
+		EGLint numConfig;
+		if (!eglChooseConfig(gl_.display, attributeList, &gl_.config, 1, &numConfig) || numConfig == 0)
+		{
+			throw std::runtime_error("Can't find gl config (check if requested samples count supported)");
+		}
 	}
 
 	eglBindAPI(EGL_OPENGL_ES_API);
@@ -62,7 +73,7 @@ height_(height)
 		EGL_CONTEXT_CLIENT_VERSION, 2,
 		EGL_NONE
 	};
-	gl_.context = eglCreateContext(gl_.display, config, EGL_NO_CONTEXT, contextAttibutes);
+	gl_.context = eglCreateContext(gl_.display, gl_.config, shareContext ? shareContext->gl_.context : EGL_NO_CONTEXT, contextAttibutes);
 	if (!gl_.context)
 	{
 		throw std::runtime_error("Can't create gles 2 context");
@@ -74,7 +85,7 @@ height_(height)
 		EGL_HEIGHT, static_cast<EGLint>(height),
 		EGL_NONE
 	};
-	gl_.surface = eglCreatePbufferSurface(gl_.display, config, surfAttributes);
+	gl_.surface = eglCreatePbufferSurface(gl_.display, gl_.config, surfAttributes);
 	if (!gl_.surface)
 	{
 		throw std::runtime_error("Can't create render surface");
@@ -123,7 +134,7 @@ GlContextANGLE::GLData::~GLData()
 		context = EGL_NO_CONTEXT;
 	}
 
-	if (display != EGL_NO_DISPLAY)
+	if (display != EGL_NO_DISPLAY && ownsDisplay)
 	{
 		eglTerminate(display);
 		display = EGL_NO_DISPLAY;
@@ -144,11 +155,44 @@ uint32_t GlContextANGLE::GetSurfaceHeight() const
 	return height_;
 }
 
-std::vector<uint8_t> GlContextANGLE::GetRasterGLES()
+// pbuffer surface keeps its size, it only makes context current and receives GLES readback of share group
+void GlContextANGLE::Resize(uint32_t width, uint32_t height)
 {
-	const auto FBOBytesPerPixel = 4;
+	CHECK_EX(width > 0 && height > 0, "Invalid render target size");
+	CHECK_EX(!inShareGroup_, "Context of share group can't be resized");
+	if (width == width_ && height == height_)
+	{
+		return;
+	}
+
+	width_ = width;
+	height_ = height;
+	CreateMultisampledFBO(width_, height_, samples_);
+	glBindFramebuffer(GL_FRAMEBUFFER, gl_.fbo.GetHandle());
+}
+
+uint32_t GlContextANGLE::GetSamples() const
+{
+	return samples_;
+}
 
-	std::vector<uint8_t> tempPixelBuffer(GetSurfaceWidth() * GetSurfaceHeight() * FBOBytesPerPixel);
+void GlContextANGLE::MakeCurrent()
+{
+	if (!eglMakeCurrent(gl_.display, gl_.surface, gl_.surface, gl_.context))
+	{
+		throw std::runtime_error("Can't setup gl context");
+	}
+}
+
+void GlContextANGLE::ReleaseCurrent()
+{
+	eglMakeCurrent(gl_.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
+void GlContextANGLE::ReadRasterGLES(uint8_t* raster)
+{
+	const auto FBOBytesPerPixel = 4;
+	rgbaRaster_.resize(GetSurfaceWidth() * GetSurfaceHeight() * FBOBytesPerPixel);
 
 	GLint currentFBO = 0;
 	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &currentFBO);
@@ -156,23 +200,42 @@ std::vector<uint8_t> GlContextANGLE::GetRasterGLES()
 
 	glBindFramebuffer(GL_READ_FRAMEBUFFER_ANGLE, 0);
 	glPixelStorei(GL_PACK_ALIGNMENT, 1);
-	glReadPixels(0, 0, GetSurfaceWidth(), GetSurfaceHeight(), GL_RGBA, GL_UNSIGNED_BYTE, tempPixelBuffer.data());
+	glReadPixels(0, 0, GetSurfaceWidth(), GetSurfaceHeight(), GL_RGBA, GL_UNSIGNED_BYTE, rgbaRaster_.data());
 	GL_CHECK();
 
-	std::vector<uint8_t> retVal(GetSurfaceWidth() * GetSurfaceHeight());
-	for (auto i = 0u; i < tempPixelBuffer.size(); i += FBOBytesPerPixel)
+	for (size_t i = 0; i < rgbaRaster_.size(); i += FBOBytesPerPixel)
 	{
-		retVal[i / FBOBytesPerPixel] = tempPixelBuffer[i];
+		raster[i / FBOBytesPerPixel] = rgbaRaster_[i];
 	}
 
 	glBindFramebuffer(GL_FRAMEBUFFER, currentFBO);
-	return retVal;
+}
+
+// Resolve and staging textures are kept between readbacks of same sized render targets.
+struct GlContextANGLE::ReadbackTargets
+{
+	D3D11_TEXTURE2D_DESC desc;
+	CComPtr<ID3D11Texture2D> resolveTarget;
+	CComPtr<ID3D11Texture2D> sysmemTarget;
+};
+
+std::vector<uint8_t> GlContextANGLE::GetRaster()
+{
+	std::vector<uint8_t> result(GetSurfaceWidth() * GetSurfaceHeight());
+	ReadRaster(result.data());
+	return result;
 }
 
 // All extraction & manipulation with underlying d3d11 device here is for performance
 // (about 2x faster than glReadPixels on ANGLE).
-std::vector<uint8_t> GlContextANGLE::GetRaster()
+void GlContextANGLE::ReadRaster(uint8_t* raster)
 {
+	if (inShareGroup_)
+	{
+		ReadRasterGLES(raster);
+		return;
+	}
+
 	auto queryDisplayAttribEXT =
 		(PFNEGLQUERYDISPLAYATTRIBEXTPROC)eglGetProcAddress("eglQueryDisplayAttribEXT");
 	auto queryDeviceAttribEXT =
@@ -196,9 +259,6 @@ std::vector<uint8_t> GlContextANGLE::GetRaster()
 	CComPtr<ID3D11Resource> rtResource;
 	rtView->GetResource(&rtResource);
 
-	CComPtr<ID3D11Texture2D> resolveTarget;
-	CComPtr<ID3D11Texture2D> sysmemTarget;
-
 	CComQIPtr<ID3D11Texture2D> rtTexture(rtResource);
 	D3D11_TEXTURE2D_DESC rtDesc;
 	rtTexture->GetDesc(&rtDesc);
@@ -206,28 +266,36 @@ std::vector<uint8_t> GlContextANGLE::GetRaster()
 	rtDesc.BindFlags = 0;
 	rtDesc.SampleDesc.Count = 1;
 	rtDesc.SampleDesc.Quality = 0;
-	CHECK(SUCCEEDED(device->CreateTexture2D(&rtDesc, nullptr, &resolveTarget)));
-	context->ResolveSubresource(resolveTarget, 0, rtTexture, 0, rtDesc.Format);
+	CHECK(rtDesc.Width == GetSurfaceWidth() && rtDesc.Height == GetSurfaceHeight());
 
-	rtDesc.Usage = D3D11_USAGE_STAGING;
-	rtDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-	CHECK(SUCCEEDED(device->CreateTexture2D(&rtDesc, nullptr, &sysmemTarget)));
-	context->CopyResource(sysmemTarget, resolveTarget);
+	if (!readback_ || readback_->desc.Width != rtDesc.Width || readback_->desc.Height != rtDesc.Height ||
+		readback_->desc.Format != rtDesc.Format)
+	{
+		readback_ = std::make_unique<ReadbackTargets>();
+		readback_->desc = rtDesc;
+		CHECK(SUCCEEDED(device->CreateTexture2D(&rtDesc, nullptr, &readback_->resolveTarget)));
+
+		rtDesc.Usage = D3D11_USAGE_STAGING;
+		rtDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		CHECK(SUCCEEDED(device->CreateTexture2D(&rtDesc, nullptr, &readback_->sysmemTarget)));
+	}
 
-	std::vector<uint8_t> result(rtDesc.Width * rtDesc.Height);
+	context->ResolveSubresource(readback_->resolveTarget, 0, rtTexture, 0, readback_->desc.Format);
+	context->CopyResource(readback_->sysmemTarget, readback_->resolveTarget);
 
 	D3D11_MAPPED_SUBRESOURCE mapInfo;
-	CHECK(SUCCEEDED(context->Map(sysmemTarget, 0, D3D11_MAP_READ, 0, &mapInfo)));
+	CHECK(SUCCEEDED(context->Map(readback_->sysmemTarget, 0, D3D11_MAP_READ, 0, &mapInfo)));
 	const auto TextureBytesPerPixel = 4;
-	for (size_t y = 0; y < rtDesc.Height; ++y)
+	const auto width = readback_->desc.Width;
+	for (size_t y = 0; y < readback_->desc.Height; ++y)
 	{
-		for (size_t x = 0; x < rtDesc.Width; ++x)
+		const auto row = reinterpret_cast<const uint8_t*>(mapInfo.pData) + mapInfo.RowPitch * y;
+		for (size_t x = 0; x < width; ++x)
 		{
-			result[rtDesc.Width*y + x] = reinterpret_cast<const uint8_t*>(mapInfo.pData)[mapInfo.RowPitch*y + x*TextureBytesPerPixel];
+			raster[width * y + x] = row[x * TextureBytesPerPixel];
 		}
 	}
-	context->Unmap(sysmemTarget, 0);
-	return result;
+	context->Unmap(readback_->sysmemTarget, 0);
 }
 
 void GlContextANGLE::SetRaster(const std::vector<uint8_t>& raster, uint32_t width, uint32_t height)
@@ -321,6 +389,12 @@ std::unique_ptr<IGlContext> CreateOffscreenGlContext(uint32_t width, uint32_t he
 	return std::make_unique<GlContextANGLE>(width, height, samples);
 }
 
+std::unique_ptr<IGlContext> CreateSharedOffscreenGlContext(IGlContext& shareContext)
+{
+	auto& source = dynamic_cast<GlContextANGLE&>(shareContext);
+	return std::make_unique<GlContextANGLE>(source.GetSurfaceWidth(), source.GetSurfaceHeight(), source.GetSamples(), &source);
+}
+
 namespace
 {
 void CheckRequiredEGLExtensions(EGLDisplay display)
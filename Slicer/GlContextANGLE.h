@@ -7,19 +7,28 @@
 class GlContextANGLE : public IGlContext
 {
 public:
-	GlContextANGLE(uint32_t width, uint32_t height, uint32_t samples);
+	// context created with shareContext shares its objects, display and config, shareContext has to outlive it
+	GlContextANGLE(uint32_t width, uint32_t height, uint32_t samples, GlContextANGLE* shareContext = nullptr);
 	~GlContextANGLE();
+
+	uint32_t GetSamples() const;
+
 private:
 
 	uint32_t GetSurfaceWidth() const override;
 	uint32_t GetSurfaceHeight() const override;
+	void Resize(uint32_t width, uint32_t height) override;
 
 	void SwapBuffers() override;
+	void MakeCurrent() override;
+	void ReleaseCurrent() override;
 	std::vector<uint8_t> GetRaster() override;
-	std::vector<uint8_t> GetRasterGLES();
+	void ReadRaster(uint8_t* raster) override;
+	void ReadRasterGLES(uint8_t* raster);
 	void SetRaster(const std::vector<uint8_t>& raster, uint32_t width, uint32_t height) override;
 
 	void CreateTextureFBO(GLFramebuffer& fbo, GLTexture& texture) override;
+	void CreateTextureFBO(uint32_t width, uint32_t height, GLFramebuffer& fbo, GLTexture& texture) override;
 	void Resolve(const GLFramebuffer& fboTo) override;
 	void ResetFBO() override;
 
@@ -27,15 +36,17 @@ private:
 	void Blit(GLuint fboFrom, GLuint fboTo);
 
 	void CreateMultisampledFBO(uint32_t width, uint32_t height, uint32_t samples);
-	void CreateTextureFBO(uint32_t width, uint32_t height, GLFramebuffer& fbo, GLTexture& texture);
 	
 
 	struct GLData
 	{
-		GLData() : display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT), surface(EGL_NO_SURFACE) {}
+		GLData() : display(EGL_NO_DISPLAY), ownsDisplay(true), config(nullptr), context(EGL_NO_CONTEXT), surface(EGL_NO_SURFACE) {}
 		~GLData();
 
 		EGLDisplay display;
+		// display is terminated by context which initialized it
+		bool ownsDisplay;
+		EGLConfig config;
 		EGLContext context;
 		EGLSurface surface;
 
@@ -47,9 +58,17 @@ private:
 		GLFramebuffer textureFBO;
 	};
 
+	struct ReadbackTargets;
+
 	GLData gl_;
+	// declared after gl_ so it is released while device is alive
+	std::unique_ptr<ReadbackTargets> readback_;
 	uint32_t width_;
 	uint32_t height_;
+	uint32_t samples_;
+	// contexts of share group use one d3d11 device, so its render targets can't be read directly
+	bool inShareGroup_;
+	std::vector<uint8_t> rgbaRaster_;
 
 	std::unique_ptr<RasterSetter> rasterSetter_;
 };
\ No newline at end of file
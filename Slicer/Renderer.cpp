@@ -11,6 +11,7 @@
 #include <PngFile.h>
 #include <Loaders.h>
 #include <Raster.h>
+#include <Morphology.h>
 #include <PerfTimer.h>
 #include <Geometry.h>
 
@@ -25,17 +26,38 @@
 #include <chrono>
 #include <thread>
 #include <cerrno>
+#include <cstring>
 
 #include <boost/filesystem.hpp>
 #include <boost/scope_exit.hpp>
 
 namespace
 {
-	bool HasOverhangs(const std::vector<uint8_t>& raster, uint32_t width, uint32_t height);
+	// each reduce pass takes max of ReduceFactor x ReduceFactor block (see ReduceMaxFShader)
+	const uint32_t ReduceFactor = 4;
+	const uint32_t MaxReducedSize = 16;
+
+	// pixels scattered by one draw call of spot area accumulation
+	const uint32_t AreaTileSize = 256;
+	// levels of 4x4 block sums, so large spot is accumulated from few block sums instead of all its pixels
+	const uint32_t SpotSumLevels = 3;
+	const uint32_t SpotSumFactor = 4;
+	// label propagation passes between convergence checks, each check is a small readback
+	const uint32_t LabelCheckInterval = 4;
 } //namespace
 
 
 Renderer::Renderer(const Settings& settings) :
+Renderer(settings, nullptr)
+{
+}
+
+Renderer::Renderer(const Settings& settings, Renderer& shareGroup) :
+Renderer(settings, &shareGroup)
+{
+}
+
+Renderer::Renderer(const Settings& settings, Renderer* shareGroup) :
 settings_(settings),
 modelOffset_(0,0),
 
@@ -51,9 +73,21 @@ maskWVPTransformUniform_(0),
 maskTextureUniform_(0),
 maskPlateSizeUniform_(0),
 
-palette_(CreateGrayscalePalette())
+gpuSmallSpots_(false),
+
+geometryHash_(0),
+slice_(0),
+
+palette_(CreateGrayscalePalette()),
+pipeline_(shareGroup ? shareGroup->pipeline_ : CreatePipeline()),
+framePool_(shareGroup ? shareGroup->framePool_ : CreateFramePool()),
+outputSequence_(0)
 {
-	if (settings_.offscreen)
+	if (shareGroup)
+	{
+		glContext_ = CreateSharedOffscreenGlContext(*shareGroup->glContext_);
+	}
+	else if (settings_.offscreen)
 	{
 		glContext_ = CreateOffscreenGlContext(settings_.renderWidth, settings_.renderHeight, settings_.samples);
 	}
@@ -88,19 +122,16 @@ palette_(CreateGrayscalePalette())
 	ASSERT(maskVertexPosAttrib_ != -1);
 	GL_CHECK();
 
-	omniDilateProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(OmniDilateFShader));
+	maxFilterProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(MaxFilterFShader));
+	dilateCombineProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(DilateCombineFShader));
 	differenceProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(DifferenceFShader));
 	combineMaxProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(CombineMaxFShader));
+	reduceMaxProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(ReduceMaxFShader));
 	
 	whiteTexture_ = GLTexture::Create();
 	maskTexture_ = GLTexture::Create();
 
-	glContext_->CreateTextureFBO(imageFBO_, imageTexture_);
-	glContext_->CreateTextureFBO(previousLayerImageFBO_, previousLayerImageTexture_);
-	White();
-	glContext_->Resolve(previousLayerImageFBO_);
-	glContext_->CreateTextureFBO(temporaryFBO_, temporaryTexture_);
-	GL_CHECK();
+	CreateRenderTargets();
 
 	const uint32_t WhiteOpaquePixel = 0xFFFFFFFF;
 	glBindTexture(GL_TEXTURE_2D, whiteTexture_.GetHandle());
@@ -113,14 +144,114 @@ palette_(CreateGrayscalePalette())
 	glDepthFunc(GL_ALWAYS);
 	glDepthMask(GL_TRUE);
 
+	if (shareGroup)
+	{
+		geometry_ = shareGroup->geometry_;
+		geometryHash_ = shareGroup->geometryHash_;
+		model_ = shareGroup->model_;
+		cache_ = shareGroup->cache_;
+	}
+	else
+	{
+		CreateGeometryBuffers();
+		SetupOutput();
+	}
+}
+
+void Renderer::StartJob(const Settings& settings)
+{
+	CHECK_EX(settings.offscreen == settings_.offscreen && settings.samples == settings_.samples,
+		"Jobs of renderer need same window mode and samples");
+	CHECK_EX(settings.contexts == 1, "Jobs of renderer are rendered with single context");
+
+	const auto resized = settings.renderWidth != settings_.renderWidth || settings.renderHeight != settings_.renderHeight;
+	const auto framesChanged = resized || settings.queue != settings_.queue;
+	const auto needsReduceLevels = reduceLevels_.empty() && (settings.doOverhangAnalysis || settings.doSmallSpotsProcessing);
+	const auto needsSmallSpots = settings.doSmallSpotsProcessing && !settings_.doSmallSpotsProcessing;
+
+	settings_ = settings;
+	slice_ = 0;
+	modelOffset_ = glm::vec2(0, 0);
+	outputSequence_ = 0;
+	raster_.Release();
+
+	if (resized)
+	{
+		glContext_->Resize(settings_.renderWidth, settings_.renderHeight);
+		CreateRenderTargets();
+	}
+	else
+	{
+		// overhang analysis of first slice compares with white layer like in new renderer
+		White();
+		glContext_->Resolve(previousLayerImageFBO_);
+		if (needsReduceLevels)
+		{
+			CreateReduceLevels();
+		}
+		if (needsSmallSpots)
+		{
+			CreateSmallSpotsResources();
+		}
+		GL_CHECK();
+	}
+
+	// previous pipeline was finished by WaitForPendingWrites
+	pipeline_ = CreatePipeline();
+	if (framesChanged)
+	{
+		framePool_ = CreateFramePool();
+	}
+	cache_.reset();
+
 	CreateGeometryBuffers();
+	SetupOutput();
+}
+
+std::shared_ptr<SlicePipeline> Renderer::CreatePipeline() const
+{
+	return std::make_shared<SlicePipeline>(settings_.renderWidth, settings_.renderHeight,
+		palette_, settings_.lowBitDepth, settings_.simulate, settings_.queue, settings_.queue, settings_.contexts);
 }
 
-Renderer::~Renderer()
+// queued, encoding and currently prepared frames
+std::shared_ptr<FramePool> Renderer::CreateFramePool() const
 {
-	for (auto& v : pngSaveResult_)
+	return std::make_shared<FramePool>(settings_.renderWidth * settings_.renderHeight, 2 * settings_.queue + settings_.contexts);
+}
+
+// targets sized by render resolution
+void Renderer::CreateRenderTargets()
+{
+	glContext_->CreateTextureFBO(imageFBO_, imageTexture_);
+	glContext_->CreateTextureFBO(previousLayerImageFBO_, previousLayerImageTexture_);
+	White();
+	glContext_->Resolve(previousLayerImageFBO_);
+	glContext_->CreateTextureFBO(temporaryFBO_, temporaryTexture_);
+	glContext_->CreateTextureFBO(dilateFBO_, dilateTexture_);
+	reduceLevels_.clear();
+	if (settings_.doOverhangAnalysis || settings_.doSmallSpotsProcessing)
+	{
+		CreateReduceLevels();
+	}
+	gpuSmallSpots_ = false;
+	if (settings_.doSmallSpotsProcessing)
+	{
+		CreateSmallSpotsResources();
+	}
+	GL_CHECK();
+}
+
+void Renderer::SetupOutput()
+{
+	if (!settings_.cacheDir.empty())
 	{
-		v.get();
+		cache_ = std::make_shared<SliceCache>(settings_.cacheDir, uint64_t(settings_.cacheSize) * 1024 * 1024, geometryHash_);
+		pipeline_->SetCache(cache_, settings_.mirrorX, settings_.mirrorY);
+	}
+	if (!settings_.simulate && settings_.writeThreads > 0)
+	{
+		pipeline_->SetFileWriter(std::make_shared<AsyncFileWriter>(settings_.writeThreads, settings_.queue, settings_.sync));
 	}
 }
 
@@ -130,8 +261,9 @@ void Renderer::CreateGeometryBuffers()
 	model_.min = glm::vec3(std::numeric_limits<float>::max());
 	model_.max = glm::vec3(std::numeric_limits<float>::lowest());
 
+	auto geometry = std::make_shared<Geometry>();
 	LoadModel(settings_.modelFile,
-		[this](const std::vector<float>& vb, const std::vector<float>& nb, const std::vector<uint16_t>& ib) {
+		[this, &geometry](const std::vector<float>& vb, const std::vector<float>& nb, const std::vector<uint16_t>& ib) {
 
 		auto vertexBuffer = GLBuffer::Create();
 		auto normalBuffer = GLBuffer::Create();
@@ -146,9 +278,9 @@ void Renderer::CreateGeometryBuffers()
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer.GetHandle());
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, ib.size() * sizeof(ib[0]), ib.data(), GL_STATIC_DRAW);
 
-		this->vBuffers_.push_back(std::move(vertexBuffer));
-		this->nBuffers_.push_back(std::move(normalBuffer));
-		this->iBuffers_.push_back(std::move(indexBuffer));
+		geometry->vBuffers.push_back(std::move(vertexBuffer));
+		geometry->nBuffers.push_back(std::move(normalBuffer));
+		geometry->iBuffers.push_back(std::move(indexBuffer));
 
 		glm::vec3 meshMin(std::numeric_limits<float>::max());
 		glm::vec3 meshMax(std::numeric_limits<float>::lowest());
@@ -162,12 +294,14 @@ void Renderer::CreateGeometryBuffers()
 		info.idxCount = static_cast<GLsizei>(ib.size());
 		info.zMin = meshMin.z;
 		info.zMax = meshMax.z;
-		this->meshInfo_.push_back(info);
+		geometry->meshInfo.push_back(info);
 
 		model_.min = glm::min(model_.min, meshMin);
 		model_.max = glm::max(model_.max, meshMax);
 	});
 	model_.pos = model_.min.z;
+	geometry_ = geometry;
+	geometryHash_ = CalculateGeometryHash(settings_);
 
 	const auto extent = model_.max - model_.min;
 	if (extent.x > settings_.plateWidth || extent.y > settings_.plateHeight)
@@ -175,10 +309,117 @@ void Renderer::CreateGeometryBuffers()
 		throw std::runtime_error("Model is larger than platform");
 	}
 
-	BOOST_LOG_TRIVIAL(info) << "Split parts: " << meshInfo_.size();
+	BOOST_LOG_TRIVIAL(info) << "Split parts: " << geometry_->meshInfo.size();
 	BOOST_LOG_TRIVIAL(info) << "Model dimensions: " << extent.x << " x " << extent.y << " x " << extent.z;
 }
 
+// at least one level, so FindSetTiles reads its own render target also for small images
+void Renderer::CreateReduceLevels()
+{
+	auto width = settings_.renderWidth;
+	auto height = settings_.renderHeight;
+	do
+	{
+		width = (width + ReduceFactor - 1) / ReduceFactor;
+		height = (height + ReduceFactor - 1) / ReduceFactor;
+
+		ReduceLevel level;
+		level.width = width;
+		level.height = height;
+		glContext_->CreateTextureFBO(width, height, level.fbo, level.texture);
+		reduceLevels_.push_back(std::move(level));
+	} while (width > MaxReducedSize || height > MaxReducedSize);
+}
+
+void Renderer::CreateSmallSpotsResources()
+{
+	const auto extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+	GLint vertexTextureUnits = 0;
+	glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &vertexTextureUnits);
+	if (!extensions || !strstr(extensions, "GL_OES_texture_float") || vertexTextureUnits < 3)
+	{
+		BOOST_LOG_TRIVIAL(info) << "Small spots are processed on CPU: float textures or vertex texture fetch are not supported";
+		return;
+	}
+	// spot areas are summed by additive blending into float target
+	if (!strstr(extensions, "GL_EXT_float_blend"))
+	{
+		BOOST_LOG_TRIVIAL(info) << "Small spots are processed on CPU: blending into float render target is not supported";
+		return;
+	}
+
+	const auto createFloatTarget = [this](uint32_t width, uint32_t height, GLFramebuffer& fbo, GLTexture& texture) {
+		texture = GLTexture::Create();
+		glBindTexture(GL_TEXTURE_2D, texture.GetHandle());
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		fbo = GLFramebuffer::Create();
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo.GetHandle());
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture.GetHandle(), 0);
+		const auto status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glContext_->ResetFBO();
+		GL_CHECK();
+		return status == GL_FRAMEBUFFER_COMPLETE;
+	};
+
+	auto complete = createFloatTarget(settings_.renderWidth, settings_.renderHeight, areaFBO_, areaTexture_);
+	spotSumLevels_.clear();
+	auto width = settings_.renderWidth;
+	auto height = settings_.renderHeight;
+	for (uint32_t i = 0; complete && i < SpotSumLevels; ++i)
+	{
+		width = (width + SpotSumFactor - 1) / SpotSumFactor;
+		height = (height + SpotSumFactor - 1) / SpotSumFactor;
+
+		ReduceLevel level;
+		level.width = width;
+		level.height = height;
+		complete = createFloatTarget(width, height, level.fbo, level.texture);
+		spotSumLevels_.push_back(std::move(level));
+	}
+	if (!complete)
+	{
+		BOOST_LOG_TRIVIAL(info) << "Small spots are processed on CPU: float render target is not supported";
+		areaFBO_ = GLFramebuffer();
+		areaTexture_ = GLTexture();
+		spotSumLevels_.clear();
+		return;
+	}
+
+	for (size_t i = 0; i < labelFBO_.size(); ++i)
+	{
+		glContext_->CreateTextureFBO(labelFBO_[i], labelTexture_[i]);
+	}
+
+	labelInitProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(LabelInitFShader));
+	labelPropagateProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(LabelPropagateFShader));
+	labelChangedProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(LabelChangedFShader));
+	labelAttachProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(LabelAttachFShader));
+	spotSumInitProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(SpotSumInitFShader));
+	spotSumReduceProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(SpotSumReduceFShader));
+	spotAreaProgram_ = CreateProgram(CreateVertexShader(SpotAreaVShader), CreateFragmentShader(SpotAreaFShader));
+	spotSumAreaProgram_ = CreateProgram(CreateVertexShader(SpotSumAreaVShader), CreateFragmentShader(SpotAreaFShader));
+	smallSpotFillProgram_ = CreateProgram(CreateVertexShader(Filter2DVShader), CreateFragmentShader(SmallSpotFillFShader));
+
+	std::vector<float> tilePoints;
+	tilePoints.reserve(AreaTileSize * AreaTileSize * 2);
+	const auto tileSize = static_cast<int>(AreaTileSize);
+	ForEachPixel(std::make_pair(0, tileSize), std::make_pair(0, tileSize), [&tilePoints](int x, int y) {
+		tilePoints.push_back(static_cast<float>(x));
+		tilePoints.push_back(static_cast<float>(y));
+	});
+	areaTileBuffer_ = GLBuffer::Create();
+	glBindBuffer(GL_ARRAY_BUFFER, areaTileBuffer_.GetHandle());
+	glBufferData(GL_ARRAY_BUFFER, tilePoints.size() * sizeof(tilePoints[0]), tilePoints.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GL_CHECK();
+
+	gpuSmallSpots_ = true;
+}
+
 uint32_t Renderer::GetLayersCount() const
 {
 	return static_cast<uint32_t>((model_.max.z - model_.min.z) / settings_.step + 0.5f);
@@ -186,21 +427,69 @@ uint32_t Renderer::GetLayersCount() const
 
 void Renderer::FirstSlice()
 {
-	model_.pos = model_.min.z + settings_.step/2;
+	slice_ = 0;
+	model_.pos = GetSlicePosition(slice_);
 	Render();
 }
 
 bool Renderer::NextSlice()
 {
-	model_.pos += settings_.step;
-	if (model_.pos >= model_.max.z)
+	return GoToSlice(slice_ + 1);
+}
+
+bool Renderer::GoToSlice(uint32_t slice)
+{
+	if (!IsSliceInModel(slice))
 	{
 		return false;
 	}
+	slice_ = slice;
+	model_.pos = GetSlicePosition(slice_);
 	Render();
 	return true;
 }
 
+bool Renderer::IsSliceEmpty(uint32_t slice) const
+{
+	const auto position = GetSlicePosition(slice);
+	const auto inflateDistance = (settings_.doInflate ? settings_.inflateDistance : 0.0f) +
+		(settings_.doSmallSpotsProcessing ? settings_.smallSpotInflateDistance : 0.0f);
+	return std::none_of(geometry_->meshInfo.begin(), geometry_->meshInfo.end(), [position, inflateDistance](const MeshInfo& info) {
+		return info.zMin - inflateDistance <= position && position <= info.zMax + inflateDistance;
+	});
+}
+
+uint32_t Renderer::GetSliceCount() const
+{
+	uint32_t count = 0;
+	while (IsSliceInModel(count))
+	{
+		++count;
+	}
+	return count;
+}
+
+// computed from index, so any process or context renders same slice at bitwise same height
+float Renderer::GetSlicePosition(uint32_t slice) const
+{
+	return model_.min.z + settings_.step / 2 + slice * settings_.step;
+}
+
+bool Renderer::IsSliceInModel(uint32_t slice) const
+{
+	return GetSlicePosition(slice) < model_.max.z;
+}
+
+void Renderer::MakeCurrent()
+{
+	glContext_->MakeCurrent();
+}
+
+void Renderer::ReleaseCurrent()
+{
+	glContext_->ReleaseCurrent();
+}
+
 void Renderer::White()
 {
 	glViewport(0, 0, settings_.renderWidth, settings_.renderHeight);
@@ -280,53 +569,338 @@ void Renderer::RenderCommon()
 	if (settings_.doSmallSpotsProcessing)
 	{
 		glContext_->Resolve(imageFBO_);
-		auto raster = glContext_->GetRaster();
-		std::vector<uint32_t> segmentedRaster(raster.size());
-		std::vector<Segment> segments;
-		
-		Segmentize(raster, segmentedRaster, segments, settings_.renderWidth, settings_.renderHeight, 255);
+		const auto& mask = gpuSmallSpots_ ? RenderSmallSpotsMask() : UploadSmallSpotsMask();
+
+		Model(wvpMatrix, (settings_.doInflate ? settings_.inflateDistance : 0.0f) + settings_.smallSpotInflateDistance);
+		Mask(wvpMatrix, wvMatrix, mask);
+		glContext_->Resolve(temporaryFBO_);
+
+		RenderCombineMax(temporaryTexture_);
+	}
+}
+
+uint32_t Renderer::GetSmallSpotsDilateRadius() const
+{
+	// same extent as repeated 3x3 dilation until smallSpotInflateDistance is reached
+	const auto physWidth = settings_.plateWidth / settings_.renderWidth;
+	const auto physHeight = settings_.plateHeight / settings_.renderHeight;
+	return static_cast<uint32_t>(settings_.smallSpotInflateDistance / ((physWidth + physHeight) / 2)) + 1;
+}
 
-		const auto physWidth = settings_.plateWidth / settings_.renderWidth;
-		const auto physHeight = settings_.plateHeight / settings_.renderHeight;
-		const auto physPixelArea = physWidth * physHeight;
+const GLTexture& Renderer::RenderSmallSpotsMask()
+{
+	const auto& labelTexture = RenderComponentLabels();
+	const auto attachIndex = &labelTexture == &labelTexture_[0] ? 1 : 0;
 
-		for (const auto& segment : segments)
+	UniformSetters attachUniforms
+	{
+		[this](const GLProgram& program)
 		{
-			const uint8_t fillValue =
-				CalculateSegmentArea(segment, physPixelArea, raster,
-					segmentedRaster, settings_.renderWidth, settings_.renderHeight) > settings_.smallSpotThreshold ? 0 : 255;
-			
-			ForEachPixel(ExpandRange(segment.xBegin, segment.xEnd, 0, settings_.renderWidth),
-				ExpandRange(segment.yBegin, segment.yEnd, 0, settings_.renderHeight), [&](auto x, auto y) {
-					const size_t pixelIndex = y*settings_.renderWidth + x;
-					if (raster[pixelIndex] > 0 &&
-						AnyOfPixels(ExpandRange(x, x + 1, 0, settings_.renderWidth), ExpandRange(y, y + 1, 0, settings_.renderHeight),
-							[&](auto x, auto y) { return segmentedRaster[y*settings_.renderWidth + x] == segment.val; }))
-					{
-						raster[pixelIndex] = fillValue;
-					}
-			});
+			const auto imageTextureUniform = glGetUniformLocation(program.GetHandle(), "imageTexture");
+			ASSERT(imageTextureUniform != -1);
+			glUniform1i(imageTextureUniform, 1);
+
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, this->imageTexture_.GetHandle());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		}
-		
-		std::vector<uint8_t> rasterDilated(raster.size());
-		float expansionSize = 0.0f;
-		while (expansionSize <= settings_.smallSpotInflateDistance)
+	};
+	glBindFramebuffer(GL_FRAMEBUFFER, labelFBO_[attachIndex].GetHandle());
+	Render2DFilter(labelAttachProgram_, labelTexture, attachUniforms);
+
+	RenderSpotArea(labelTexture_[attachIndex]);
+
+	const auto physPixelArea = (settings_.plateWidth / settings_.renderWidth) * (settings_.plateHeight / settings_.renderHeight);
+	const auto maxArea = settings_.smallSpotThreshold / physPixelArea;
+	UniformSetters fillUniforms
+	{
+		[this, attachIndex, maxArea](const GLProgram& program)
 		{
-			Dilate(raster, rasterDilated, settings_.renderWidth, settings_.renderHeight);
-			std::swap(raster, rasterDilated);
-			expansionSize += (physWidth + physHeight) / 2;
+			const auto maxAreaUniform = glGetUniformLocation(program.GetHandle(), "maxArea");
+			ASSERT(maxAreaUniform != -1);
+			glUniform1f(maxAreaUniform, maxArea);
+
+			const auto labelTextureUniform = glGetUniformLocation(program.GetHandle(), "labelTexture");
+			ASSERT(labelTextureUniform != -1);
+			glUniform1i(labelTextureUniform, 1);
+
+			const auto areaTextureUniform = glGetUniformLocation(program.GetHandle(), "areaTexture");
+			ASSERT(areaTextureUniform != -1);
+			glUniform1i(areaTextureUniform, 2);
+
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, this->labelTexture_[attachIndex].GetHandle());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+			glActiveTexture(GL_TEXTURE2);
+			glBindTexture(GL_TEXTURE_2D, this->areaTexture_.GetHandle());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		}
+	};
+	const auto fillIndex = attachIndex ^ 1;
+	glBindFramebuffer(GL_FRAMEBUFFER, labelFBO_[fillIndex].GetHandle());
+	Render2DFilter(smallSpotFillProgram_, imageTexture_, fillUniforms);
 
-		glBindTexture(GL_TEXTURE_2D, maskTexture_.GetHandle());
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, settings_.renderWidth, settings_.renderHeight, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, raster.data());
-		glBindTexture(GL_TEXTURE_2D, 0);
+	const auto& mask = RenderDilate(labelTexture_[fillIndex], GetSmallSpotsDilateRadius());
+	glContext_->ResetFBO();
+	return mask;
+}
 
-		Model(wvpMatrix, (settings_.doInflate ? settings_.inflateDistance : 0.0f) + settings_.smallSpotInflateDistance);
-		Mask(wvpMatrix, wvMatrix, maskTexture_);
-		glContext_->Resolve(temporaryFBO_);
+const GLTexture& Renderer::RenderComponentLabels()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, labelFBO_[0].GetHandle());
+	Render2DFilter(labelInitProgram_, imageTexture_);
 
-		RenderCombineMax(temporaryTexture_);
+	// labels grow monotonically, so single pass without changes means convergence
+	auto current = 0;
+	for (uint32_t pass = 1; ; ++pass)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, labelFBO_[current ^ 1].GetHandle());
+		Render2DFilter(labelPropagateProgram_, labelTexture_[current]);
+		current ^= 1;
+
+		if (pass % LabelCheckInterval != 0)
+		{
+			continue;
+		}
+
+		UniformSetters changedUniforms
+		{
+			[this, current](const GLProgram& program)
+			{
+				const auto previousLabelTextureUniform = glGetUniformLocation(program.GetHandle(), "previousLabelTexture");
+				ASSERT(previousLabelTextureUniform != -1);
+				glUniform1i(previousLabelTextureUniform, 1);
+
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_2D, this->labelTexture_[current ^ 1].GetHandle());
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			}
+		};
+		glBindFramebuffer(GL_FRAMEBUFFER, dilateFBO_.GetHandle());
+		Render2DFilter(labelChangedProgram_, labelTexture_[current], changedUniforms);
+		if (!FindSetTiles(dilateTexture_, 255, [](uint32_t, uint32_t, uint32_t) {}))
+		{
+			BOOST_LOG_TRIVIAL(trace) << "Small spot labels converged in " << pass << " passes";
+			break;
+		}
+	}
+	return labelTexture_[current];
+}
+
+// 4x4 block sums of coverage per label, chained over sum levels
+void Renderer::RenderSpotSums(const GLTexture& labelTexture)
+{
+	UniformSetters initUniforms
+	{
+		[this](const GLProgram& program)
+		{
+			const auto imageTextureUniform = glGetUniformLocation(program.GetHandle(), "imageTexture");
+			ASSERT(imageTextureUniform != -1);
+			glUniform1i(imageTextureUniform, 1);
+
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, this->imageTexture_.GetHandle());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		}
+	};
+	glBindFramebuffer(GL_FRAMEBUFFER, spotSumLevels_[0].fbo.GetHandle());
+	Render2DFilter(spotSumInitProgram_, labelTexture, initUniforms, settings_.renderWidth, settings_.renderHeight,
+		spotSumLevels_[0].width, spotSumLevels_[0].height);
+
+	for (size_t i = 1; i < spotSumLevels_.size(); ++i)
+	{
+		const auto& source = spotSumLevels_[i - 1];
+		glBindFramebuffer(GL_FRAMEBUFFER, spotSumLevels_[i].fbo.GetHandle());
+		Render2DFilter(spotSumReduceProgram_, source.texture, UniformSetters(), source.width, source.height,
+			spotSumLevels_[i].width, spotSumLevels_[i].height);
+	}
+}
+
+// Coverage is scattered as points to texel of its label with additive blending. Largest blocks of single label are
+// scattered as one point with their sum, so large spots don't serialize blending on their label texel; only pixels
+// of blocks with several labels are scattered one by one. Vertex cost is still one point per pixel of area tiles
+// which contain image (up to renderWidth * renderHeight points, ~33M at 8K), empty tiles are skipped.
+void Renderer::RenderSpotArea(const GLTexture& labelTexture)
+{
+	const auto tilesX = (settings_.renderWidth + AreaTileSize - 1) / AreaTileSize;
+	const auto tilesY = (settings_.renderHeight + AreaTileSize - 1) / AreaTileSize;
+	std::vector<bool> setTiles(tilesX * tilesY, false);
+	FindSetTiles(imageTexture_, 1, [&](uint32_t x, uint32_t y, uint32_t tileSize) {
+		const auto xEnd = std::min(tilesX, ((x + 1) * tileSize + AreaTileSize - 1) / AreaTileSize);
+		const auto yEnd = std::min(tilesY, ((y + 1) * tileSize + AreaTileSize - 1) / AreaTileSize);
+		for (auto tileY = y * tileSize / AreaTileSize; tileY < yEnd; ++tileY)
+		{
+			for (auto tileX = x * tileSize / AreaTileSize; tileX < xEnd; ++tileX)
+			{
+				setTiles[tileY * tilesX + tileX] = true;
+			}
+		}
+	});
+	// tile of level with blocks of blockSize pixels is drawn if any of pixel tiles it covers has image
+	const auto isTileSet = [&](uint32_t tileX, uint32_t tileY, uint32_t blockSize) {
+		return AnyOfPixels(
+			std::make_pair(static_cast<int>(tileX * blockSize), static_cast<int>(std::min(tilesX, (tileX + 1) * blockSize))),
+			std::make_pair(static_cast<int>(tileY * blockSize), static_cast<int>(std::min(tilesY, (tileY + 1) * blockSize))),
+			[&](int x, int y) { return setTiles[y * tilesX + x]; });
+	};
+	const auto bindTexture = [](GLenum unit, const GLTexture& texture) {
+		glActiveTexture(unit);
+		glBindTexture(GL_TEXTURE_2D, texture.GetHandle());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	};
+
+	RenderSpotSums(labelTexture);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, areaFBO_.GetHandle());
+	glViewport(0, 0, settings_.renderWidth, settings_.renderHeight);
+	glDisable(GL_STENCIL_TEST);
+	glClearColor(0.0, 0.0, 0.0, 0.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);
+	glBindBuffer(GL_ARRAY_BUFFER, areaTileBuffer_.GetHandle());
+
+	// pixels of blocks with several labels
+	{
+		const auto program = spotAreaProgram_.GetHandle();
+		glUseProgram(program);
+		const auto textureUniform = glGetUniformLocation(program, "texture");
+		ASSERT(textureUniform != -1);
+		const auto labelTextureUniform = glGetUniformLocation(program, "labelTexture");
+		ASSERT(labelTextureUniform != -1);
+		const auto parentTextureUniform = glGetUniformLocation(program, "parentTexture");
+		ASSERT(parentTextureUniform != -1);
+		const auto texelSizeUniform = glGetUniformLocation(program, "texelSize");
+		ASSERT(texelSizeUniform != -1);
+		const auto parentTexelSizeUniform = glGetUniformLocation(program, "parentTexelSize");
+		ASSERT(parentTexelSizeUniform != -1);
+		const auto tileOriginUniform = glGetUniformLocation(program, "tileOrigin");
+		ASSERT(tileOriginUniform != -1);
+		const auto vertexPosAttrib = glGetAttribLocation(program, "vPosition");
+		ASSERT(vertexPosAttrib != -1);
+
+		const auto& parent = spotSumLevels_[0];
+		bindTexture(GL_TEXTURE0, imageTexture_);
+		bindTexture(GL_TEXTURE1, labelTexture);
+		bindTexture(GL_TEXTURE2, parent.texture);
+		glUniform1i(textureUniform, 0);
+		glUniform1i(labelTextureUniform, 1);
+		glUniform1i(parentTextureUniform, 2);
+		glUniform2f(texelSizeUniform, 1.0f / settings_.renderWidth, 1.0f / settings_.renderHeight);
+		glUniform2f(parentTexelSizeUniform, 1.0f / parent.width, 1.0f / parent.height);
+
+		glVertexAttribPointer(vertexPosAttrib, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+		glEnableVertexAttribArray(vertexPosAttrib);
+		for (uint32_t tileY = 0; tileY < tilesY; ++tileY)
+		{
+			for (uint32_t tileX = 0; tileX < tilesX; ++tileX)
+			{
+				if (!setTiles[tileY * tilesX + tileX])
+				{
+					continue;
+				}
+				glUniform2f(tileOriginUniform, static_cast<float>(tileX * AreaTileSize), static_cast<float>(tileY * AreaTileSize));
+				glDrawArrays(GL_POINTS, 0, AreaTileSize * AreaTileSize);
+			}
+		}
+	}
+
+	// largest blocks of single label
+	{
+		const auto program = spotSumAreaProgram_.GetHandle();
+		glUseProgram(program);
+		const auto levelTextureUniform = glGetUniformLocation(program, "levelTexture");
+		ASSERT(levelTextureUniform != -1);
+		const auto parentTextureUniform = glGetUniformLocation(program, "parentTexture");
+		ASSERT(parentTextureUniform != -1);
+		const auto texelSizeUniform = glGetUniformLocation(program, "texelSize");
+		ASSERT(texelSizeUniform != -1);
+		const auto levelTexelSizeUniform = glGetUniformLocation(program, "levelTexelSize");
+		ASSERT(levelTexelSizeUniform != -1);
+		const auto parentTexelSizeUniform = glGetUniformLocation(program, "parentTexelSize");
+		ASSERT(parentTexelSizeUniform != -1);
+		const auto hasParentUniform = glGetUniformLocation(program, "hasParent");
+		ASSERT(hasParentUniform != -1);
+		const auto tileOriginUniform = glGetUniformLocation(program, "tileOrigin");
+		ASSERT(tileOriginUniform != -1);
+		const auto vertexPosAttrib = glGetAttribLocation(program, "vPosition");
+		ASSERT(vertexPosAttrib != -1);
+
+		glUniform1i(levelTextureUniform, 0);
+		glUniform1i(parentTextureUniform, 1);
+		glUniform2f(texelSizeUniform, 1.0f / settings_.renderWidth, 1.0f / settings_.renderHeight);
+		glVertexAttribPointer(vertexPosAttrib, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+		glEnableVertexAttribArray(vertexPosAttrib);
+
+		// pixel tiles covered by one tile of level
+		uint32_t blockSize = 1;
+		for (size_t i = 0; i < spotSumLevels_.size(); ++i)
+		{
+			blockSize *= SpotSumFactor;
+			const auto& level = spotSumLevels_[i];
+			const auto hasParent = i + 1 < spotSumLevels_.size();
+			const auto& parent = hasParent ? spotSumLevels_[i + 1] : level;
+			bindTexture(GL_TEXTURE0, level.texture);
+			bindTexture(GL_TEXTURE1, parent.texture);
+			glUniform2f(levelTexelSizeUniform, 1.0f / level.width, 1.0f / level.height);
+			glUniform2f(parentTexelSizeUniform, 1.0f / parent.width, 1.0f / parent.height);
+			glUniform1f(hasParentUniform, hasParent ? 1.0f : 0.0f);
+
+			for (uint32_t tileY = 0; tileY * AreaTileSize < level.height; ++tileY)
+			{
+				for (uint32_t tileX = 0; tileX * AreaTileSize < level.width; ++tileX)
+				{
+					if (!isTileSet(tileX, tileY, blockSize))
+					{
+						continue;
+					}
+					glUniform2f(tileOriginUniform, static_cast<float>(tileX * AreaTileSize), static_cast<float>(tileY * AreaTileSize));
+					glDrawArrays(GL_POINTS, 0, AreaTileSize * AreaTileSize);
+				}
+			}
+		}
 	}
+
+	glDisable(GL_BLEND);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	GL_CHECK();
+}
+
+const GLTexture& Renderer::UploadSmallSpotsMask()
+{
+	// frame sized buffers are members, so they keep capacity between slices
+	auto& raster = smallSpotRaster_;
+	auto& segmentedRaster = smallSpotLabels_;
+	raster.resize(settings_.renderWidth * settings_.renderHeight);
+	segmentedRaster.resize(raster.size());
+	glContext_->ReadRaster(raster.data());
+
+	Segmentize(raster, segmentedRaster, smallSpotSegments_, settings_.renderWidth, settings_.renderHeight, 255);
+
+	const auto physPixelArea = (settings_.plateWidth / settings_.renderWidth) * (settings_.plateHeight / settings_.renderHeight);
+	const auto segmentsArea = CalculateSegmentsArea(smallSpotSegments_, physPixelArea, raster,
+		segmentedRaster, settings_.renderWidth, settings_.renderHeight);
+
+	std::vector<uint8_t> fillTable(segmentsArea.size());
+	std::transform(segmentsArea.begin(), segmentsArea.end(), fillTable.begin(), [this](float area) {
+		return static_cast<uint8_t>(area > settings_.smallSpotThreshold ? 0 : 255);
+	});
+	FillSegments(fillTable, raster, segmentedRaster, settings_.renderWidth, settings_.renderHeight);
+
+	DilateSquare(raster, smallSpotDilated_, settings_.renderWidth, settings_.renderHeight, GetSmallSpotsDilateRadius());
+
+	glBindTexture(GL_TEXTURE_2D, maskTexture_.GetHandle());
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, settings_.renderWidth, settings_.renderHeight, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, smallSpotDilated_.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return maskTexture_;
 }
 
 void Renderer::RenderOffscreen()
@@ -372,20 +946,21 @@ void Renderer::Model(const glm::mat4x4& wvpMatrix, float inflateDistance)
 	glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_INCR);
 	glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_DECR);
 	glStencilFunc(GL_ALWAYS, 0, 0xFF);
-	for (auto i = 0u; i < vBuffers_.size(); ++i)
+	const auto& geometry = *geometry_;
+	for (auto i = 0u; i < geometry.vBuffers.size(); ++i)
 	{
-		if (ShouldRender(meshInfo_[i], inflateDistance))
+		if (ShouldRender(geometry.meshInfo[i], inflateDistance))
 		{
-			glBindBuffer(GL_ARRAY_BUFFER, vBuffers_[i].GetHandle());
+			glBindBuffer(GL_ARRAY_BUFFER, geometry.vBuffers[i].GetHandle());
 			glVertexAttribPointer(mainVertexPosAttrib_, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
 			glEnableVertexAttribArray(mainVertexPosAttrib_);
 
-			glBindBuffer(GL_ARRAY_BUFFER, nBuffers_[i].GetHandle());
+			glBindBuffer(GL_ARRAY_BUFFER, geometry.nBuffers[i].GetHandle());
 			glVertexAttribPointer(mainVertexNormalAttrib_, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
 			glEnableVertexAttribArray(mainVertexNormalAttrib_);
 
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuffers_[i].GetHandle());
-			glDrawElements(GL_TRIANGLES, meshInfo_[i].idxCount, GL_UNSIGNED_SHORT, 0);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry.iBuffers[i].GetHandle());
+			glDrawElements(GL_TRIANGLES, geometry.meshInfo[i].idxCount, GL_UNSIGNED_SHORT, 0);
 		}
 	}	
 
@@ -450,32 +1025,83 @@ float Renderer::GetMirrorYFactor() const
 	return ShouldMirrorY() ? -1.0f : 1.0f;
 }
 
+// with slice cache mirrors are applied by pipeline, so cached images stay reusable
 bool Renderer::ShouldMirrorX() const
 {
-	return settings_.mirrorX ^ IsUpsideDownRendering();
+	return (settings_.mirrorX && !cache_) ^ IsUpsideDownRendering();
 }
 
 bool Renderer::ShouldMirrorY() const
 {
-	return settings_.mirrorY;
+	return settings_.mirrorY && !cache_;
+}
+
+const GLTexture& Renderer::RenderDilate(const GLTexture& source, uint32_t radius)
+{
+	// square (2*radius+1) max kernel as separable chain of 3-tap passes with offsets 1, 2, 4, ... + remainder,
+	// so cost grows with log(radius) instead of radius^2
+	std::vector<uint32_t> steps;
+	for (uint32_t step = 1, covered = 0; covered < radius; step *= 2)
+	{
+		steps.push_back(std::min(step, radius - covered));
+		covered += steps.back();
+	}
+
+	const std::pair<const GLFramebuffer*, const GLTexture*> pingPong[] =
+	{
+		std::make_pair(&temporaryFBO_, &temporaryTexture_),
+		std::make_pair(&dilateFBO_, &dilateTexture_)
+	};
+	auto current = 0u;
+	const GLTexture* result = &source;
+	for (const auto& direction : { glm::vec2(1.0f, 0.0f), glm::vec2(0.0f, 1.0f) })
+	{
+		for (const auto step : steps)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, pingPong[current].first->GetHandle());
+			RenderMaxFilter(*result, direction * static_cast<float>(step));
+			result = pingPong[current].second;
+			current ^= 1;
+		}
+	}
+	return *result;
+}
+
+void Renderer::RenderMaxFilter(const GLTexture& texture, const glm::vec2& offset)
+{
+	UniformSetters maxFilterUniforms
+	{
+		[&offset](const GLProgram& program)
+		{
+			const auto offsetUniform = glGetUniformLocation(program.GetHandle(), "offset");
+			ASSERT(offsetUniform != -1);
+			glUniform2f(offsetUniform, offset.x, offset.y);
+		}
+	};
+	Render2DFilter(maxFilterProgram_, texture, maxFilterUniforms);
 }
 
-void Renderer::RenderOmniDilate(float scale, uint32_t kernelSize)
+void Renderer::RenderDilateCombine(const GLTexture& dilatedTexture, float scale)
 {
-	UniformSetters omniUniforms
+	UniformSetters dilateCombineUniforms
 	{
-		[scale, kernelSize](const GLProgram& program)
+		[&dilatedTexture, scale](const GLProgram& program)
 		{
 			const auto scaleUniform = glGetUniformLocation(program.GetHandle(), "scale");
 			ASSERT(scaleUniform != -1);
 			glUniform1f(scaleUniform, scale);
 
-			const auto kernelSizeUniform = glGetUniformLocation(program.GetHandle(), "kernelSize");
-			ASSERT(kernelSizeUniform != -1);
-			glUniform1f(kernelSizeUniform, static_cast<float>(kernelSize));
+			const auto dilatedTextureUniform = glGetUniformLocation(program.GetHandle(), "dilatedTexture");
+			ASSERT(dilatedTextureUniform != -1);
+			glUniform1i(dilatedTextureUniform, 1);
+
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, dilatedTexture.GetHandle());
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		}
 	};
-	Render2DFilter(omniDilateProgram_, omniUniforms);
+	Render2DFilter(dilateCombineProgram_, imageTexture_, dilateCombineUniforms);
 }
 
 void Renderer::RenderDifference()
@@ -494,7 +1120,7 @@ void Renderer::RenderDifference()
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		}
 	};
-	Render2DFilter(differenceProgram_, differenceUniforms);
+	Render2DFilter(differenceProgram_, imageTexture_, differenceUniforms);
 }
 
 void Renderer::RenderCombineMax(const GLTexture& combineTexture)
@@ -513,12 +1139,25 @@ void Renderer::RenderCombineMax(const GLTexture& combineTexture)
 			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		}
 	};
-	Render2DFilter(combineMaxProgram_, combineMaxUniforms);
+	Render2DFilter(combineMaxProgram_, imageTexture_, combineMaxUniforms);
 }
 
-void Renderer::Render2DFilter(const GLProgram& program, const UniformSetters& additionalUniformSetters)
+void Renderer::RenderReduceMax(const GLTexture& texture, uint32_t textureWidth, uint32_t textureHeight)
 {
-	glViewport(0, 0, settings_.renderWidth, settings_.renderHeight);
+	Render2DFilter(reduceMaxProgram_, texture, UniformSetters(), textureWidth, textureHeight,
+		(textureWidth + ReduceFactor - 1) / ReduceFactor, (textureHeight + ReduceFactor - 1) / ReduceFactor);
+}
+
+void Renderer::Render2DFilter(const GLProgram& program, const GLTexture& texture, const UniformSetters& additionalUniformSetters)
+{
+	Render2DFilter(program, texture, additionalUniformSetters,
+		settings_.renderWidth, settings_.renderHeight, settings_.renderWidth, settings_.renderHeight);
+}
+
+void Renderer::Render2DFilter(const GLProgram& program, const GLTexture& texture, const UniformSetters& additionalUniformSetters,
+	uint32_t textureWidth, uint32_t textureHeight, uint32_t targetWidth, uint32_t targetHeight)
+{
+	glViewport(0, 0, targetWidth, targetHeight);
 
 	glDisable(GL_STENCIL_TEST);
 	glCullFace(GL_FRONT);
@@ -541,12 +1180,14 @@ void Renderer::Render2DFilter(const GLProgram& program, const UniformSetters& ad
 	GL_CHECK();
 
 	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, imageTexture_.GetHandle());
+	glBindTexture(GL_TEXTURE_2D, texture.GetHandle());
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
 	glUniform1i(textureUniform, 0);
-	glUniform2f(texelSizeUniform, 1.0f / settings_.renderWidth, 1.0f / settings_.renderHeight);
+	glUniform2f(texelSizeUniform, 1.0f / textureWidth, 1.0f / textureHeight);
 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	const float quad[] =
@@ -570,40 +1211,83 @@ void Renderer::Render2DFilter(const GLProgram& program, const UniformSetters& ad
 
 void Renderer::SavePng(const std::string& fileName)
 {
-	if (raster_.empty())
+	if (!raster_.IsValid())
 	{
-		raster_ = glContext_->GetRaster();
+		raster_ = framePool_->Acquire();
+		glContext_->ReadRaster(raster_.GetData());
 	}
 
-	auto pixData = std::make_shared<const std::vector<uint8_t>>(std::move(raster_));
-	const auto concurrency = settings_.queue;
-	const bool clearCompletedTasks = pngSaveResult_.size() > concurrency;
+	// frame goes back to pool once encoded
+	pipeline_->Push(outputSequence_++, fileName, std::move(raster_));
+}
 
-	const auto targetWidth = settings_.renderWidth;
-	const auto targetHeight = settings_.renderHeight;
-	auto future = std::async(std::launch::async, [pixData, fileName, targetWidth, targetHeight, this]() {
-		if (this->settings_.simulate)
-		{
-			return;
-		}
-		const auto BitsPerChannel = 8;
-		WritePng(fileName, targetWidth, targetHeight, BitsPerChannel, *pixData, this->palette_);
-	});
-	
-	if (clearCompletedTasks)
+void Renderer::SavePng(const std::string& fileName, uint64_t cacheKey)
+{
+	if (!cache_)
 	{
-		pngSaveResult_.erase(std::remove_if(pngSaveResult_.begin(), pngSaveResult_.end(), [](std::future<void>& v) {
-			return v.wait_for(std::chrono::milliseconds::zero()) == std::future_status::ready;
-		}), pngSaveResult_.end());
+		SavePng(fileName);
+		return;
+	}
 
-		if (pngSaveResult_.size() > concurrency)
-		{
-			future.get();
-			return;
-		}
+	if (!raster_.IsValid())
+	{
+		raster_ = framePool_->Acquire();
+		glContext_->ReadRaster(raster_.GetData());
 	}
 
-	pngSaveResult_.emplace_back(std::move(future));
+	pipeline_->Push(outputSequence_++, fileName, std::move(raster_), cacheKey);
+}
+
+void Renderer::SaveCachedPng(const std::string& fileName, std::vector<uint8_t> png)
+{
+	pipeline_->PushCached(outputSequence_++, fileName, std::move(png));
+}
+
+void Renderer::SaveEmptyPng(const std::string& fileName)
+{
+	auto frame = framePool_->Acquire();
+	std::fill_n(frame.GetData(), frame.GetSize(), uint8_t(0));
+	pipeline_->Push(outputSequence_++, fileName, std::move(frame));
+}
+
+SliceCache* Renderer::GetSliceCache() const
+{
+	return cache_.get();
+}
+
+uint64_t Renderer::GetGeometryHash() const
+{
+	return geometryHash_;
+}
+
+void Renderer::SetArchive(const std::shared_ptr<ZipWriter>& archive)
+{
+	pipeline_->SetArchive(archive);
+}
+
+void Renderer::SetLayerStack(const std::shared_ptr<LayerStackWriter>& layerStack)
+{
+	pipeline_->SetLayerStack(layerStack);
+}
+
+void Renderer::SetOutputSequence(uint64_t sequence)
+{
+	outputSequence_ = sequence;
+}
+
+void Renderer::SetPngWrittenHandler(const SlicePipeline::WrittenHandler& handler)
+{
+	pipeline_->SetWrittenHandler(handler);
+}
+
+void Renderer::SetPngOutputHandler(const SlicePipeline::OutputHandler& handler)
+{
+	pipeline_->SetOutputHandler(handler);
+}
+
+void Renderer::WaitForPendingWrites()
+{
+	pipeline_->Finish();
 }
 
 void Renderer::ERM()
@@ -625,20 +1309,68 @@ void Renderer::AnalyzeOverhangs(uint32_t imageNumber)
 	glContext_->Resolve(imageFBO_);
 	glBindFramebuffer(GL_FRAMEBUFFER, temporaryFBO_.GetHandle());
 	RenderDifference();
-	raster_ = glContext_->GetRaster();
-	if (HasOverhangs(raster_, glContext_->GetSurfaceWidth(), glContext_->GetSurfaceHeight()))
+	if (HasOverhangs(imageNumber))
 	{
+		// full frame is only needed to save it, reduce passes left other FBO bound
+		glBindFramebuffer(GL_FRAMEBUFFER, temporaryFBO_.GetHandle());
+		RenderDifference();
+		raster_ = framePool_->Acquire();
+		glContext_->ReadRaster(raster_.GetData());
+
 		std::cout << "Has overhangs at image: " << imageNumber << "\n";
 		std::stringstream s;
 		s << std::setfill('0') << std::setw(5) << imageNumber << "_overhangs.png";
 		SavePng((boost::filesystem::path(settings_.outputDir) / s.str()).string());
 	}
-	raster_.clear();
+	raster_.Release();
 
-	glBindFramebuffer(GL_FRAMEBUFFER, previousLayerImageFBO_.GetHandle());
 	const auto supportedPixels = static_cast<uint32_t>(ceil(settings_.maxSupportedDistance * settings_.renderWidth / settings_.plateWidth));
-	RenderOmniDilate(1.0f, supportedPixels * 2 + 1);
+	const auto& dilated = RenderDilate(imageTexture_, supportedPixels);
+	glBindFramebuffer(GL_FRAMEBUFFER, previousLayerImageFBO_.GetHandle());
+	RenderDilateCombine(dilated, 1.0f);
+	glContext_->ResetFBO();
+}
+
+bool Renderer::HasOverhangs(uint32_t imageNumber)
+{
+	return FindSetTiles(temporaryTexture_, 255, [imageNumber](uint32_t x, uint32_t y, uint32_t tileSize) {
+		BOOST_LOG_TRIVIAL(info) << "Overhang at image " << imageNumber << " in " <<
+			tileSize << "x" << tileSize << " tile at (" << x * tileSize << ", " << y * tileSize << ")";
+	});
+}
+
+bool Renderer::FindSetTiles(const GLTexture& texture, uint8_t threshold, const std::function<void(uint32_t x, uint32_t y, uint32_t tileSize)>& action)
+{
+	const GLTexture* source = &texture;
+	auto sourceWidth = settings_.renderWidth;
+	auto sourceHeight = settings_.renderHeight;
+	uint32_t tileSize = 1;
+	for (const auto& level : reduceLevels_)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, level.fbo.GetHandle());
+		RenderReduceMax(*source, sourceWidth, sourceHeight);
+		source = &level.texture;
+		sourceWidth = level.width;
+		sourceHeight = level.height;
+		tileSize *= ReduceFactor;
+	}
+
+	const auto FBOBytesPerPixel = 4;
+	std::vector<uint8_t> tiles(sourceWidth * sourceHeight * FBOBytesPerPixel);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, sourceWidth, sourceHeight, GL_RGBA, GL_UNSIGNED_BYTE, tiles.data());
+	GL_CHECK();
 	glContext_->ResetFBO();
+
+	bool found = false;
+	ForEachPixel(std::make_pair(0, static_cast<int>(sourceWidth)), std::make_pair(0, static_cast<int>(sourceHeight)), [&](int x, int y) {
+		if (tiles[(y * sourceWidth + x) * FBOBytesPerPixel] >= threshold)
+		{
+			found = true;
+			action(x, y, tileSize);
+		}
+	});
+	return found;
 }
 
 std::pair<glm::vec2, glm::vec2> Renderer::GetModelProjectionRect() const
@@ -661,22 +1393,3 @@ std::pair<glm::vec2, glm::vec2> Renderer::GetModelProjectionRect() const
 
 	return std::make_pair(glm::min(screenMin, screenMax), glm::max(screenMin, screenMax));
 }
-
-namespace
-{
-
-	bool HasOverhangs(const std::vector<uint8_t>& raster, uint32_t width, uint32_t height)
-	{
-		const auto Threshold = 255;
-		for (auto v : raster)
-		{
-			if (v >= Threshold)
-			{
-				return true;
-			}
-		}
-		return false;
-	}
-
-	
-} //namespace
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "GlContext.h"
+#include "SlicePipeline.h"
+
+#include <FramePool.h>
+#include <Raster.h>
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -10,6 +14,7 @@
 #include <vector>
 #include <array>
 #include <future>
+#include <memory>
 
 #include <cstdint>
 
@@ -52,20 +57,99 @@ struct Settings
 	bool mirrorX = false;
 	bool mirrorY = false;
 
+	// write 1, 2 or 4-bit PNG when slice has few gray levels
+	bool lowBitDepth = false;
+
 	bool simulate = false;
+
+	// rendering contexts in one share group, each renders interleaved subset of slices on own thread
+	uint32_t contexts = 1;
+
+	// shards > 1 makes process coordinator of shard workers, worker renders shard with given index
+	uint32_t shards = 1;
+	int32_t shard = -1;
+	std::string shardLauncher;
+
+	// skip slices recorded in output directory manifest by interrupted run of same job
+	bool resume = true;
+
+	// ZIP file receiving slices and job config instead of output directory
+	std::string archive;
+
+	// RLE layer stack file receiving all layers instead of PNG files
+	std::string layerStack;
+	// layers between keyframes are stored as delta to previous layer
+	uint32_t keyframeInterval = 1;
+
+	// slice contours cut from mesh: CLI file if path ends with ".cli", directory of SVG files otherwise
+	std::string contours;
+	// false writes only contours, model is not rendered
+	bool raster = true;
+
+	// slice files written concurrently to hide storage latency, 0 writes them one by one on pipeline writer thread
+	uint32_t writeThreads = 4;
+	SyncPolicy sync = SyncPolicy::None;
+
+	// loopback port of slice-on-demand server, 0 renders whole job
+	uint32_t serverPort = 0;
+	// slices rendered by server ahead of last requested layer
+	uint32_t prefetch = 16;
+	// encoded layers kept in memory by server
+	uint32_t serverCacheSize = 512; // MB
+
+	// persistent slice image cache reused by later jobs with same model and geometry settings
+	std::string cacheDir;
+	uint32_t cacheSize = 4096; // MB
 };
 
 class Renderer
 {
 public:
 	Renderer(const Settings& settings);
-	~Renderer();
+	// Renders with own context in share group of shareGroup, reuses its geometry buffers, frame pool and output pipeline.
+	// shareGroup has to outlive it.
+	Renderer(const Settings& settings, Renderer& shareGroup);
+
+	// Reuses context, programs and render targets for next job, render targets are re-created only when resolution
+	// changes. Call after WaitForPendingWrites of previous job; window mode and samples can't change.
+	void StartJob(const Settings& settings);
+
+	// context is current on creating thread, release it there before rendering on other thread
+	void MakeCurrent();
+	void ReleaseCurrent();
 
 	void SavePng(const std::string& fileName);
+	// output goes to archive or layer stack instead of files if set
+	void SetArchive(const std::shared_ptr<ZipWriter>& archive);
+	void SetLayerStack(const std::shared_ptr<LayerStackWriter>& layerStack);
+	// also stores unmirrored image in slice cache
+	void SavePng(const std::string& fileName, uint64_t cacheKey);
+	// outputs unmirrored image loaded from slice cache
+	void SaveCachedPng(const std::string& fileName, std::vector<uint8_t> png);
+	// outputs black image without rendering
+	void SaveEmptyPng(const std::string& fileName);
+	// order of next saved image in output, incremented by each SavePng
+	void SetOutputSequence(uint64_t sequence);
+	// handler must be thread-safe, it's called concurrently by file writer threads
+	void SetPngWrittenHandler(const SlicePipeline::WrittenHandler& handler);
+	// encoded images are passed to handler instead of output
+	void SetPngOutputHandler(const SlicePipeline::OutputHandler& handler);
+	// waits for queued slices, logs pipeline statistics, rethrows first failure
+	void WaitForPendingWrites();
+
+	// null if slice cache is not enabled
+	SliceCache* GetSliceCache() const;
+	uint64_t GetGeometryHash() const;
 
 	uint32_t GetLayersCount() const;
+	// exact number of slices rendered by FirstSlice/NextSlice
+	uint32_t GetSliceCount() const;
 	void FirstSlice();
 	bool NextSlice();
+	// returns false if slice is above model
+	bool GoToSlice(uint32_t slice);
+	// no part (inflated) crosses slice plane, so slice renders black
+	bool IsSliceEmpty(uint32_t slice) const;
 	void White();
 	void ERM();
 	void AnalyzeOverhangs(uint32_t imageNumber);
@@ -90,10 +174,35 @@ private:
 		float zMax = 0.0f;
 	};
 
+	struct ReduceLevel
+	{
+		uint32_t width = 0;
+		uint32_t height = 0;
+		GLFramebuffer fbo;
+		GLTexture texture;
+	};
+
+	struct Geometry
+	{
+		std::vector<GLBuffer> vBuffers;
+		std::vector<GLBuffer> nBuffers;
+		std::vector<GLBuffer> iBuffers;
+		std::vector<MeshInfo> meshInfo;
+	};
+
 	using UniformSetterType = std::function<void(const GLProgram&)>;
 	using UniformSetters = std::vector<UniformSetterType>;
 
+	Renderer(const Settings& settings, Renderer* shareGroup);
+
+	std::shared_ptr<SlicePipeline> CreatePipeline() const;
+	std::shared_ptr<FramePool> CreateFramePool() const;
+	void CreateRenderTargets();
 	void CreateGeometryBuffers();
+	// slice cache and file writer of pipeline
+	void SetupOutput();
+	void CreateReduceLevels();
+	void CreateSmallSpotsResources();
 
 	bool IsUpsideDownRendering() const;
 	bool ShouldRender(const MeshInfo& info, float inflateDistance);
@@ -102,10 +211,24 @@ private:
 	glm::mat4x4 CalculateViewTransform() const;
 	glm::mat4x4 CalculateProjectionTransform() const;
 	void RenderCommon();
-	void RenderOmniDilate(float scale, uint32_t kernelSize);
+	const GLTexture& RenderSmallSpotsMask();
+	const GLTexture& UploadSmallSpotsMask();
+	uint32_t GetSmallSpotsDilateRadius() const;
+	const GLTexture& RenderComponentLabels();
+	void RenderSpotSums(const GLTexture& labelTexture);
+	void RenderSpotArea(const GLTexture& labelTexture);
+	const GLTexture& RenderDilate(const GLTexture& source, uint32_t radius);
+	void RenderMaxFilter(const GLTexture& texture, const glm::vec2& offset);
+	void RenderDilateCombine(const GLTexture& dilatedTexture, float scale);
 	void RenderDifference();
 	void RenderCombineMax(const GLTexture& additionalTexture);
-	void Render2DFilter(const GLProgram& program, const UniformSetters& additionalUniformSetters = UniformSetters());
+	void RenderReduceMax(const GLTexture& texture, uint32_t textureWidth, uint32_t textureHeight);
+	void Render2DFilter(const GLProgram& program, const GLTexture& texture,
+		const UniformSetters& additionalUniformSetters = UniformSetters());
+	void Render2DFilter(const GLProgram& program, const GLTexture& texture, const UniformSetters& additionalUniformSetters,
+		uint32_t textureWidth, uint32_t textureHeight, uint32_t targetWidth, uint32_t targetHeight);
+	bool HasOverhangs(uint32_t imageNumber);
+	bool FindSetTiles(const GLTexture& texture, uint8_t threshold, const std::function<void(uint32_t x, uint32_t y, uint32_t tileSize)>& action);
 	void RenderOffscreen();
 	void RenderFullscreen();
 
@@ -113,6 +236,8 @@ private:
 	void Mask(const glm::mat4x4& wvpMatrix, const glm::mat4x4& wvMatrix, const GLTexture& mask);
 
 	uint32_t GetCurrentSlice() const;
+	float GetSlicePosition(uint32_t slice) const;
+	bool IsSliceInModel(uint32_t slice) const;
 	float GetMirrorXFactor() const;
 	float GetMirrorYFactor() const;
 	bool ShouldMirrorX() const;
@@ -132,9 +257,21 @@ private:
 	GLuint maskTextureUniform_;
 	GLuint maskPlateSizeUniform_;
 
-	GLProgram omniDilateProgram_;
+	GLProgram maxFilterProgram_;
+	GLProgram dilateCombineProgram_;
 	GLProgram differenceProgram_;
 	GLProgram combineMaxProgram_;
+	GLProgram reduceMaxProgram_;
+
+	GLProgram labelInitProgram_;
+	GLProgram labelPropagateProgram_;
+	GLProgram labelChangedProgram_;
+	GLProgram labelAttachProgram_;
+	GLProgram spotSumInitProgram_;
+	GLProgram spotSumReduceProgram_;
+	GLProgram spotAreaProgram_;
+	GLProgram spotSumAreaProgram_;
+	GLProgram smallSpotFillProgram_;
 
 	GLTexture maskTexture_;
 	GLTexture whiteTexture_;
@@ -148,18 +285,41 @@ private:
 	GLFramebuffer temporaryFBO_;
 	GLTexture temporaryTexture_;
 
-	std::vector<GLBuffer> vBuffers_;
-	std::vector<GLBuffer> nBuffers_;
-	std::vector<GLBuffer> iBuffers_;
-	std::vector<MeshInfo> meshInfo_;
+	GLFramebuffer dilateFBO_;
+	GLTexture dilateTexture_;
+
+	std::vector<ReduceLevel> reduceLevels_;
+
+	// small spots are processed on GPU when float render targets and vertex texture fetch are available
+	bool gpuSmallSpots_;
+	std::array<GLFramebuffer, 2> labelFBO_;
+	std::array<GLTexture, 2> labelTexture_;
+	GLFramebuffer areaFBO_;
+	GLTexture areaTexture_;
+	// float 4x4 block sums of spot coverage, each level reduces previous one
+	std::vector<ReduceLevel> spotSumLevels_;
+	GLBuffer areaTileBuffer_;
+
+	// shared by all renderers of share group
+	std::shared_ptr<const Geometry> geometry_;
+	uint64_t geometryHash_;
+	std::shared_ptr<SliceCache> cache_;
 
 	ModelData model_;
 	Settings settings_;
+	uint32_t slice_;
 
 	glm::vec2 modelOffset_;
 
 	const std::vector<uint32_t> palette_;
-	std::vector<std::future<void>> pngSaveResult_;
-	std::vector<uint8_t> raster_;
+	std::shared_ptr<SlicePipeline> pipeline_;
+	std::shared_ptr<FramePool> framePool_;
+	FrameBuffer raster_;
+	uint64_t outputSequence_;
+
+	std::vector<uint8_t> smallSpotRaster_;
+	std::vector<uint32_t> smallSpotLabels_;
+	std::vector<Segment> smallSpotSegments_;
+	std::vector<uint8_t> smallSpotDilated_;
 	std::unique_ptr<IGlContext> glContext_;
 };
@@ -75,29 +75,59 @@ const std::string Filter2DVShader = SHADER
 	}
 );
 
-const std::string OmniDilateFShader = SHADER
+// 3-tap max along offset (in texels), chained passes with growing offsets build wide kernels
+const std::string MaxFilterFShader = SHADER
 (
 	precision mediump float;
 
 	varying vec2 texCoord;
 	uniform vec2 texelSize;
 	uniform sampler2D texture;
-	uniform float kernelSize;
+	uniform vec2 offset;
+
+	void main()
+	{
+		vec2 delta = texelSize * offset;
+		vec4 color = max(texture2D(texture, texCoord - delta), texture2D(texture, texCoord + delta));
+		gl_FragColor = max(color, texture2D(texture, texCoord));
+	}
+);
+
+const std::string DilateCombineFShader = SHADER
+(
+	precision mediump float;
+
+	varying vec2 texCoord;
+	uniform sampler2D texture;
+	uniform sampler2D dilatedTexture;
 	uniform float scale;
 
 	void main()
 	{
-		vec4 maxColor = vec4(0);
-		vec2 offset = vec2(floor(kernelSize / 2.0));
-		for (float dy = 0.0; dy < kernelSize; ++dy)
+		gl_FragColor = texture2D(texture, texCoord) + texture2D(dilatedTexture, texCoord) * scale;
+	}
+);
+
+// max over 4x4 source block per target pixel, texelSize is source texel size
+const std::string ReduceMaxFShader = SHADER
+(
+	precision mediump float;
+
+	uniform vec2 texelSize;
+	uniform sampler2D texture;
+
+	void main()
+	{
+		vec2 base = (floor(gl_FragCoord.xy) * 4.0 + 0.5) * texelSize;
+		vec4 color = vec4(0);
+		for (float dy = 0.0; dy < 4.0; ++dy)
 		{
-			for (float dx = 0.0; dx < kernelSize; ++dx)
+			for (float dx = 0.0; dx < 4.0; ++dx)
 			{
-				maxColor = max(maxColor, texture2D(texture, texCoord + texelSize*(vec2(dx, dy) - offset)));
+				color = max(color, texture2D(texture, base + vec2(dx, dy) * texelSize));
 			}
 		}
-
-		gl_FragColor = texture2D(texture, texCoord) + maxColor*scale;
+		gl_FragColor = color;
 	}
 );
 
@@ -129,4 +159,308 @@ const std::string CombineMaxFShader = SHADER
 		vec4 color = max(texture2D(texture, texCoord), texture2D(combineTexture, texCoord));
 		gl_FragColor = color;
 	}
-);
\ No newline at end of file
+);
+//////////////////////////////////////
+
+// Component labels are 1-based pixel coordinates (16 bits per axis) of a pixel of the same component,
+// (0, 0) is background. Labels only grow in (y, x) order, so each component converges to its last pixel.
+const std::string LabelCodecShader = SHADER
+(
+	vec4 EncodeLabel(vec2 label)
+	{
+		vec2 high = floor(label / 256.0);
+		vec2 low = label - high * 256.0;
+		return vec4(low.x, high.x, low.y, high.y) / 255.0;
+	}
+
+	vec2 DecodeLabel(vec4 color)
+	{
+		vec4 bytes = floor(color * 255.0 + 0.5);
+		return vec2(bytes.x + bytes.y * 256.0, bytes.z + bytes.w * 256.0);
+	}
+
+	vec2 MaxLabel(vec2 a, vec2 b)
+	{
+		return (a.y > b.y || (a.y == b.y && a.x > b.x)) ? a : b;
+	}
+
+	vec2 LabelTexCoord(vec2 label, vec2 texelSize)
+	{
+		return (label - 0.5) * texelSize;
+	}
+);
+
+// fully covered pixels (same as Segmentize threshold 255) are labeled with own position
+const std::string LabelInitFShader = SHADER
+(
+	precision highp float;
+) + LabelCodecShader + SHADER
+(
+	uniform vec2 texelSize;
+	uniform sampler2D texture;
+
+	void main()
+	{
+		vec2 pixel = floor(gl_FragCoord.xy);
+		bool covered = texture2D(texture, (pixel + 0.5) * texelSize).r > 254.5 / 255.0;
+		gl_FragColor = covered ? EncodeLabel(pixel + 1.0) : vec4(0);
+	}
+);
+
+// max label of 8-connected neighbourhood followed by pointer jump to label of that pixel
+const std::string LabelPropagateFShader = SHADER
+(
+	precision highp float;
+) + LabelCodecShader + SHADER
+(
+	uniform vec2 texelSize;
+	uniform sampler2D texture;
+
+	void main()
+	{
+		vec2 pixel = floor(gl_FragCoord.xy) + 0.5;
+		vec2 label = DecodeLabel(texture2D(texture, pixel * texelSize));
+		if (label.y == 0.0)
+		{
+			gl_FragColor = vec4(0);
+			return;
+		}
+
+		for (float dy = -1.0; dy <= 1.0; ++dy)
+		{
+			for (float dx = -1.0; dx <= 1.0; ++dx)
+			{
+				label = MaxLabel(label, DecodeLabel(texture2D(texture, (pixel + vec2(dx, dy)) * texelSize)));
+			}
+		}
+		label = MaxLabel(label, DecodeLabel(texture2D(texture, LabelTexCoord(label, texelSize))));
+		gl_FragColor = EncodeLabel(label);
+	}
+);
+
+const std::string LabelChangedFShader = SHADER
+(
+	precision highp float;
+
+	uniform vec2 texelSize;
+	uniform sampler2D texture;
+	uniform sampler2D previousLabelTexture;
+
+	void main()
+	{
+		vec2 texCoord = (floor(gl_FragCoord.xy) + 0.5) * texelSize;
+		vec4 delta = abs(texture2D(texture, texCoord) - texture2D(previousLabelTexture, texCoord));
+		gl_FragColor = vec4(step(0.5 / 255.0, max(max(delta.x, delta.y), max(delta.z, delta.w))));
+	}
+);
+
+// partially covered pixels join the largest label around them
+const std::string LabelAttachFShader = SHADER
+(
+	precision highp float;
+) + LabelCodecShader + SHADER
+(
+	uniform vec2 texelSize;
+	uniform sampler2D texture;
+	uniform sampler2D imageTexture;
+
+	void main()
+	{
+		vec2 pixel = floor(gl_FragCoord.xy) + 0.5;
+		vec2 label = DecodeLabel(texture2D(texture, pixel * texelSize));
+		if (label.y == 0.0 && texture2D(imageTexture, pixel * texelSize).r > 0.0)
+		{
+			for (float dy = -1.0; dy <= 1.0; ++dy)
+			{
+				for (float dx = -1.0; dx <= 1.0; ++dx)
+				{
+					label = MaxLabel(label, DecodeLabel(texture2D(texture, (pixel + vec2(dx, dy)) * texelSize)));
+				}
+			}
+		}
+		gl_FragColor = EncodeLabel(label);
+	}
+);
+
+// Sum of 4x4 pixel block: (label of block, coverage sum of its pixels, 1 if block has no other label).
+// Pixels outside image (last row/column of blocks) are skipped.
+const std::string SpotSumInitFShader = SHADER
+(
+	precision highp float;
+) + LabelCodecShader + SHADER
+(
+	uniform vec2 texelSize;
+	uniform sampler2D texture;
+	uniform sampler2D imageTexture;
+
+	void main()
+	{
+		vec2 base = floor(gl_FragCoord.xy) * 4.0 + 0.5;
+		vec2 primary = vec2(0);
+		float sum = 0.0;
+		float pure = 1.0;
+		for (float dy = 0.0; dy < 4.0; ++dy)
+		{
+			for (float dx = 0.0; dx < 4.0; ++dx)
+			{
+				vec2 texCoord = (base + vec2(dx, dy)) * texelSize;
+				vec2 label = DecodeLabel(texture2D(texture, texCoord));
+				if (texCoord.x < 1.0 && texCoord.y < 1.0 && label.y > 0.0)
+				{
+					primary = primary.y > 0.0 ? primary : label;
+					if (label == primary)
+					{
+						sum += texture2D(imageTexture, texCoord).r;
+					}
+					else
+					{
+						pure = 0.0;
+					}
+				}
+			}
+		}
+		gl_FragColor = vec4(primary, sum, pure);
+	}
+);
+
+// same sum of 4x4 blocks of previous sum level, sum is partial for blocks which are not pure
+const std::string SpotSumReduceFShader = SHADER
+(
+	precision highp float;
+
+	uniform vec2 texelSize;
+	uniform sampler2D texture;
+
+	void main()
+	{
+		vec2 base = floor(gl_FragCoord.xy) * 4.0 + 0.5;
+		vec2 primary = vec2(0);
+		float sum = 0.0;
+		float pure = 1.0;
+		for (float dy = 0.0; dy < 4.0; ++dy)
+		{
+			for (float dx = 0.0; dx < 4.0; ++dx)
+			{
+				vec2 texCoord = (base + vec2(dx, dy)) * texelSize;
+				vec4 child = texture2D(texture, texCoord);
+				if (texCoord.x < 1.0 && texCoord.y < 1.0)
+				{
+					pure = child.a > 0.0 ? pure : 0.0;
+					if (child.y > 0.0)
+					{
+						primary = primary.y > 0.0 ? primary : child.xy;
+						if (child.xy == primary)
+						{
+							sum += child.z;
+						}
+						else
+						{
+							pure = 0.0;
+						}
+					}
+				}
+			}
+		}
+		gl_FragColor = vec4(primary, sum, pure);
+	}
+);
+
+// One point per pixel of tile, coverage is accumulated at label pixel with additive blending.
+// Pixels of pure blocks are summed by block points instead.
+const std::string SpotAreaVShader = SHADER
+(
+	precision highp float;
+) + LabelCodecShader + SHADER
+(
+	attribute vec2 vPosition;
+	uniform vec2 tileOrigin;
+	uniform vec2 texelSize;
+	uniform vec2 parentTexelSize;
+	uniform sampler2D texture;
+	uniform sampler2D labelTexture;
+	uniform sampler2D parentTexture;
+
+	varying float coverage;
+	void main()
+	{
+		vec2 pixel = tileOrigin + vPosition;
+		vec2 texCoord = (pixel + 0.5) * texelSize;
+		vec2 label = DecodeLabel(texture2DLod(labelTexture, texCoord, 0.0));
+		coverage = texture2DLod(texture, texCoord, 0.0).r;
+		float parentPure = texture2DLod(parentTexture, (floor(pixel / 4.0) + 0.5) * parentTexelSize, 0.0).a;
+
+		bool inside = label.y > 0.0 && parentPure == 0.0 && texCoord.x < 1.0 && texCoord.y < 1.0;
+		gl_Position = inside ? vec4(LabelTexCoord(label, texelSize) * 2.0 - 1.0, 0, 1) : vec4(2, 2, 0, 1);
+		gl_PointSize = 1.0;
+	}
+);
+
+// One point per block of sum level, partial sum of largest pure blocks is accumulated at label pixel.
+// Blocks inside pure parent block are summed by parent (there is no parent for last level).
+const std::string SpotSumAreaVShader = SHADER
+(
+	precision highp float;
+) + LabelCodecShader + SHADER
+(
+	attribute vec2 vPosition;
+	uniform vec2 tileOrigin;
+	uniform vec2 texelSize;
+	uniform vec2 levelTexelSize;
+	uniform vec2 parentTexelSize;
+	uniform float hasParent;
+	uniform sampler2D levelTexture;
+	uniform sampler2D parentTexture;
+
+	varying float coverage;
+	void main()
+	{
+		vec2 block = tileOrigin + vPosition;
+		vec2 levelCoord = (block + 0.5) * levelTexelSize;
+		vec4 sum = texture2DLod(levelTexture, levelCoord, 0.0);
+		float parentPure = texture2DLod(parentTexture, (floor(block / 4.0) + 0.5) * parentTexelSize, 0.0).a * hasParent;
+		coverage = sum.z;
+
+		bool inside = sum.y > 0.0 && sum.a > 0.0 && parentPure == 0.0 && levelCoord.x < 1.0 && levelCoord.y < 1.0;
+		gl_Position = inside ? vec4(LabelTexCoord(sum.xy, texelSize) * 2.0 - 1.0, 0, 1) : vec4(2, 2, 0, 1);
+		gl_PointSize = 1.0;
+	}
+);
+
+const std::string SpotAreaFShader = SHADER
+(
+	precision highp float;
+
+	varying float coverage;
+
+	void main()
+	{
+		gl_FragColor = vec4(coverage);
+	}
+);
+
+// labeled pixels become white for components not larger than maxArea (in pixels), black otherwise
+const std::string SmallSpotFillFShader = SHADER
+(
+	precision highp float;
+) + LabelCodecShader + SHADER
+(
+	uniform vec2 texelSize;
+	uniform sampler2D texture;
+	uniform sampler2D labelTexture;
+	uniform sampler2D areaTexture;
+	uniform float maxArea;
+
+	void main()
+	{
+		vec2 texCoord = (floor(gl_FragCoord.xy) + 0.5) * texelSize;
+		vec2 label = DecodeLabel(texture2D(labelTexture, texCoord));
+		if (label.y == 0.0)
+		{
+			gl_FragColor = vec4(texture2D(texture, texCoord).r);
+			return;
+		}
+
+		float area = texture2D(areaTexture, LabelTexCoord(label, texelSize)).r;
+		gl_FragColor = vec4(area > maxArea ? 0.0 : 1.0);
+	}
+);
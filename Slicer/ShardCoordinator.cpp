@@ -0,0 +1,207 @@
+#include "ShardCoordinator.h"
+
+#include <ErrorHandling.h>
+
+#include <sstream>
+
+#include <boost/log/trivial.hpp>
+
+namespace
+{
+	// quoting understood by CommandLineToArgvW and CRT argv parsing
+	std::string QuoteArgument(const std::string& argument)
+	{
+		if (!argument.empty() && argument.find_first_of(" \t\"") == std::string::npos)
+		{
+			return argument;
+		}
+
+		std::string quoted = "\"";
+		size_t backslashes = 0;
+		for (auto c : argument)
+		{
+			if (c == '\\')
+			{
+				++backslashes;
+				continue;
+			}
+			// backslashes are literal unless they precede quote
+			quoted.append(c == '"' ? backslashes * 2 + 1 : backslashes, '\\');
+			backslashes = 0;
+			quoted.push_back(c);
+		}
+		quoted.append(backslashes * 2, '\\');
+		quoted.push_back('"');
+		return quoted;
+	}
+
+	void ThrowIfFailed(const std::vector<uint32_t>& failedShards)
+	{
+		if (failedShards.empty())
+		{
+			return;
+		}
+
+		std::stringstream s;
+		s << "Shard workers failed:";
+		for (auto shard : failedShards)
+		{
+			s << " " << shard;
+		}
+		throw std::runtime_error(s.str());
+	}
+
+	class LocalShardLauncher : public IShardLauncher
+	{
+	public:
+		LocalShardLauncher() : job_(CreateJobObjectA(nullptr, nullptr))
+		{
+			CHECK_EX(job_, "Can't create job object for shard workers");
+		}
+
+		~LocalShardLauncher()
+		{
+			// coordinator failed, job output is incomplete anyway; job also kills processes started by workers
+			if (!workers_.empty())
+			{
+				TerminateJobObject(job_, 1);
+			}
+			for (const auto& worker : workers_)
+			{
+				CloseHandle(worker.process);
+			}
+			CloseHandle(job_);
+		}
+
+		void Start(uint32_t shard, const std::string& commandLine) override
+		{
+			STARTUPINFOA startupInfo{};
+			startupInfo.cb = sizeof(startupInfo);
+			PROCESS_INFORMATION processInfo{};
+			// CreateProcess may modify command line buffer
+			std::vector<char> command(commandLine.begin(), commandLine.end());
+			command.push_back('\0');
+			// suspended until it is in job, so its children are in job too
+			CHECK_EX(CreateProcessA(nullptr, command.data(), nullptr, nullptr, FALSE, CREATE_SUSPENDED, nullptr, nullptr,
+				&startupInfo, &processInfo), "Can't start shard worker");
+			if (!AssignProcessToJobObject(job_, processInfo.hProcess))
+			{
+				TerminateProcess(processInfo.hProcess, 1);
+				CloseHandle(processInfo.hThread);
+				CloseHandle(processInfo.hProcess);
+				throw std::runtime_error("Can't assign shard worker to job object");
+			}
+			ResumeThread(processInfo.hThread);
+			CloseHandle(processInfo.hThread);
+
+			Worker worker;
+			worker.shard = shard;
+			worker.process = processInfo.hProcess;
+			workers_.push_back(worker);
+		}
+
+		void Wait() override
+		{
+			std::vector<uint32_t> failedShards;
+			for (const auto& worker : workers_)
+			{
+				DWORD exitCode = 1;
+				WaitForSingleObject(worker.process, INFINITE);
+				GetExitCodeProcess(worker.process, &exitCode);
+				CloseHandle(worker.process);
+				if (exitCode != 0)
+				{
+					failedShards.push_back(worker.shard);
+				}
+			}
+			workers_.clear();
+			ThrowIfFailed(failedShards);
+		}
+
+	private:
+		struct Worker
+		{
+			uint32_t shard;
+			HANDLE process;
+		};
+
+		const HANDLE job_;
+		std::vector<Worker> workers_;
+	};
+
+	// command runs in shell process tracked as local worker, so failure kills it like local workers
+	class CommandShardLauncher : public LocalShardLauncher
+	{
+	public:
+		explicit CommandShardLauncher(const std::string& commandTemplate) : commandTemplate_(commandTemplate)
+		{
+		}
+
+		void Start(uint32_t shard, const std::string& commandLine) override
+		{
+			auto command = Substitute(commandTemplate_, "{shard}", std::to_string(shard));
+			command = Substitute(command, "{command}", commandLine);
+			BOOST_LOG_TRIVIAL(info) << "Starting shard " << shard << ": " << command;
+
+			// /S strips only outer quotes, rest of command is passed to shell as is
+			LocalShardLauncher::Start(shard, "cmd.exe /S /C \"" + command + "\"");
+		}
+
+	private:
+		static std::string Substitute(const std::string& text, const std::string& what, const std::string& to)
+		{
+			std::string result;
+			size_t pos = 0;
+			for (auto found = text.find(what); found != std::string::npos; found = text.find(what, pos))
+			{
+				result.append(text, pos, found - pos);
+				result.append(to);
+				pos = found + what.size();
+			}
+			result.append(text, pos, std::string::npos);
+			return result;
+		}
+
+		const std::string commandTemplate_;
+	};
+} //namespace
+
+std::vector<SliceRange> SplitSlices(uint32_t layers, uint32_t shards)
+{
+	ASSERT(shards > 0);
+	std::vector<SliceRange> ranges(shards);
+	for (uint32_t i = 0; i < shards; ++i)
+	{
+		ranges[i].first = static_cast<uint32_t>(static_cast<uint64_t>(layers) * i / shards);
+		if (i + 1 < shards)
+		{
+			ranges[i].end = static_cast<uint32_t>(static_cast<uint64_t>(layers) * (i + 1) / shards);
+		}
+	}
+	return ranges;
+}
+
+std::unique_ptr<IShardLauncher> CreateLocalShardLauncher()
+{
+	return std::make_unique<LocalShardLauncher>();
+}
+
+std::unique_ptr<IShardLauncher> CreateCommandShardLauncher(const std::string& commandTemplate)
+{
+	return std::make_unique<CommandShardLauncher>(commandTemplate);
+}
+
+std::string BuildShardCommandLine(int argc, char** argv, uint32_t shard)
+{
+	// argv[0] may be relative to other working directory
+	char executable[MAX_PATH] = {};
+	CHECK_EX(GetModuleFileNameA(nullptr, executable, MAX_PATH) != 0, "Can't get executable path");
+
+	std::string commandLine = QuoteArgument(executable);
+	for (int i = 1; i < argc; ++i)
+	{
+		commandLine += " " + QuoteArgument(argv[i]);
+	}
+	commandLine += " --shard " + std::to_string(shard);
+	return commandLine;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Half-open range of slice indices.
+struct SliceRange
+{
+	uint32_t first = 0;
+	// last shard is open-ended, so slices above layers estimate are not lost
+	uint32_t end = std::numeric_limits<uint32_t>::max();
+};
+
+// Splits [0, layers) into shards of equal size (+-1 slice).
+std::vector<SliceRange> SplitSlices(uint32_t layers, uint32_t shards);
+
+// Starts shard worker processes and waits for their completion.
+struct IShardLauncher
+{
+	virtual void Start(uint32_t shard, const std::string& commandLine) = 0;
+	// waits for all started workers, throws if any of them failed
+	virtual void Wait() = 0;
+
+	virtual ~IShardLauncher() {}
+};
+
+// runs workers as child processes of this machine
+std::unique_ptr<IShardLauncher> CreateLocalShardLauncher();
+// Runs commandTemplate with "{shard}" and "{command}" substituted through system shell,
+// e.g. "ssh node{shard} {command}". Command has to block until worker exits and return its exit code.
+std::unique_ptr<IShardLauncher> CreateCommandShardLauncher(const std::string& commandTemplate);
+
+// Worker command line: this executable with original arguments and shard index.
+std::string BuildShardCommandLine(int argc, char** argv, uint32_t shard);
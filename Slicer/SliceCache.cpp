@@ -0,0 +1,196 @@
+#include "SliceCache.h"
+#include "Renderer.h"
+#include "Utils.h"
+
+#include <Hash.h>
+#include <ErrorHandling.h>
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <tuple>
+
+#include <boost/filesystem.hpp>
+#include <boost/log/trivial.hpp>
+
+namespace
+{
+	// bump when rendering changes for same settings
+	const uint32_t GeometryHashVersion = 1;
+	const size_t KeyDigits = 16;
+	// temporary files of other processes storing into the same cache are younger
+	const std::time_t StaleTempFileAge = 60 * 60;
+	const size_t ModelReadChunk = 1024 * 1024;
+} //namespace
+
+uint64_t CalculateGeometryHash(const Settings& settings)
+{
+	std::ifstream file(settings.modelFile, std::ios::binary);
+	CHECK_EX(file, "Can't read model file");
+
+	std::stringstream s;
+	s << std::setprecision(9) << GeometryHashVersion << " " <<
+		settings.step << " " << settings.renderWidth << " " << settings.renderHeight << " " << settings.samples << " " <<
+		settings.plateWidth << " " << settings.plateHeight << " " << settings.doInflate << " " << settings.inflateDistance << " " <<
+		settings.doSmallSpotsProcessing << " " << settings.smallSpotThreshold << " " << settings.smallSpotInflateDistance << " " <<
+		settings.lowBitDepth;
+
+	// model can be several GB, so it's hashed in chunks
+	Hasher hasher;
+	std::vector<char> chunk(ModelReadChunk);
+	while (file.read(chunk.data(), chunk.size()) || file.gcount() > 0)
+	{
+		hasher.Update(chunk.data(), static_cast<size_t>(file.gcount()));
+	}
+	CHECK_EX(file.eof(), "Can't read model file");
+	hasher.Update(s.str());
+	return hasher.Finish();
+}
+
+SliceCache::SliceCache(const std::string& directory, uint64_t maxBytes, uint64_t geometryHash) :
+	directory_(directory),
+	maxBytes_(maxBytes),
+	geometryHash_(geometryHash),
+	totalBytes_(0),
+	hits_(0),
+	misses_(0)
+{
+	boost::filesystem::create_directories(directory_);
+
+	std::vector<std::tuple<std::time_t, uint64_t, uint64_t>> found;
+	for (boost::filesystem::directory_iterator it(directory_), end; it != end; ++it)
+	{
+		const auto& path = it->path();
+		const auto name = path.stem().string();
+		boost::system::error_code error;
+		if (path.extension() == ".tmp")
+		{
+			// left by interrupted store
+			const auto time = boost::filesystem::last_write_time(path, error);
+			if (!error && std::time(nullptr) - time > StaleTempFileAge)
+			{
+				boost::filesystem::remove(path, error);
+			}
+			continue;
+		}
+		if (path.extension() != ".png" || name.size() != KeyDigits ||
+			name.find_first_not_of("0123456789abcdef") != std::string::npos)
+		{
+			continue;
+		}
+
+		const auto size = boost::filesystem::file_size(path, error);
+		const auto time = boost::filesystem::last_write_time(path, error);
+		if (!error)
+		{
+			found.emplace_back(time, std::stoull(name, nullptr, 16), size);
+		}
+	}
+
+	std::sort(found.begin(), found.end());
+	for (const auto& entry : found)
+	{
+		Insert(std::get<1>(entry), std::get<2>(entry));
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	EvictLocked();
+	BOOST_LOG_TRIVIAL(info) << "Slice cache: " << entries_.size() << " images, " << totalBytes_ / 1024 / 1024 << " MB";
+}
+
+SliceCache::~SliceCache()
+{
+	BOOST_LOG_TRIVIAL(info) << "Slice cache hits: " << hits_ << ", misses: " << misses_ <<
+		", size: " << totalBytes_ / 1024 / 1024 << " MB";
+}
+
+uint64_t SliceCache::GetKey(uint32_t slice, uint32_t image) const
+{
+	Hasher hasher;
+	hasher.Update(&geometryHash_, sizeof(geometryHash_));
+	hasher.Update(&slice, sizeof(slice));
+	hasher.Update(&image, sizeof(image));
+	return hasher.Finish();
+}
+
+bool SliceCache::Load(uint64_t key, std::vector<uint8_t>& png)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (entries_.count(key) == 0)
+		{
+			++misses_;
+			return false;
+		}
+	}
+
+	// entry may be evicted meanwhile, then read fails
+	const auto path = GetPath(key);
+	std::ifstream file(path.string(), std::ios::binary);
+	png.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	const auto it = entries_.find(key);
+	if (!file || png.empty() || it == entries_.end() || png.size() != it->second.size)
+	{
+		++misses_;
+		return false;
+	}
+
+	++hits_;
+	recency_.splice(recency_.begin(), recency_, it->second.recency);
+	boost::system::error_code error;
+	boost::filesystem::last_write_time(path, std::time(nullptr), error);
+	return true;
+}
+
+void SliceCache::Store(uint64_t key, const std::vector<uint8_t>& png)
+{
+	WriteFileAtomically(GetPath(key).string(), png.data(), png.size());
+	Insert(key, png.size());
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	EvictLocked();
+}
+
+boost::filesystem::path SliceCache::GetPath(uint64_t key) const
+{
+	return directory_ / (FormatHash(key) + ".png");
+}
+
+void SliceCache::Insert(uint64_t key, uint64_t size)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = entries_.find(key);
+	if (it != entries_.end())
+	{
+		totalBytes_ -= it->second.size;
+		recency_.erase(it->second.recency);
+		entries_.erase(it);
+	}
+
+	recency_.push_front(key);
+	Entry entry;
+	entry.size = size;
+	entry.recency = recency_.begin();
+	entries_.emplace(key, entry);
+	totalBytes_ += size;
+}
+
+void SliceCache::EvictLocked()
+{
+	while (totalBytes_ > maxBytes_ && !recency_.empty())
+	{
+		const auto key = recency_.back();
+		recency_.pop_back();
+		const auto it = entries_.find(key);
+		totalBytes_ -= it->second.size;
+		entries_.erase(it);
+
+		boost::system::error_code error;
+		boost::filesystem::remove(GetPath(key), error);
+	}
+}
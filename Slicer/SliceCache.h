@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+struct Settings;
+
+// Hash of model file content and settings which affect unmirrored slice images or their encoding.
+// Output-only settings (white layers, mirrors, output dir, job templates) are excluded.
+uint64_t CalculateGeometryHash(const Settings& settings);
+
+// Persistent PNG store of unmirrored slice images shared by jobs with same geometry hash.
+// Entries are files named by key; least recently used are evicted when size limit is exceeded.
+// Recency survives between runs as file modification time.
+class SliceCache
+{
+public:
+	SliceCache(const std::string& directory, uint64_t maxBytes, uint64_t geometryHash);
+	~SliceCache();
+
+	// image is 0 for slice, 1 for ERM image of slice
+	uint64_t GetKey(uint32_t slice, uint32_t image) const;
+
+	// thread-safe
+	bool Load(uint64_t key, std::vector<uint8_t>& png);
+	void Store(uint64_t key, const std::vector<uint8_t>& png);
+
+private:
+	struct Entry
+	{
+		uint64_t size;
+		std::list<uint64_t>::iterator recency;
+	};
+
+	boost::filesystem::path GetPath(uint64_t key) const;
+	void Insert(uint64_t key, uint64_t size);
+	void EvictLocked();
+
+	const boost::filesystem::path directory_;
+	const uint64_t maxBytes_;
+	const uint64_t geometryHash_;
+
+	std::mutex mutex_;
+	// most recently used first
+	std::list<uint64_t> recency_;
+	std::unordered_map<uint64_t, Entry> entries_;
+	uint64_t totalBytes_;
+	uint64_t hits_;
+	uint64_t misses_;
+};
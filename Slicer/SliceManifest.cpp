@@ -0,0 +1,120 @@
+#include "SliceManifest.h"
+#include "Renderer.h"
+#include "Utils.h"
+
+#include <Hash.h>
+#include <ErrorHandling.h>
+
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/log/trivial.hpp>
+
+namespace
+{
+	// bump when slice images change for same settings
+	const uint32_t ManifestVersion = 1;
+
+	bool ReadFile(const boost::filesystem::path& path, std::vector<char>& data)
+	{
+		std::ifstream file(path.string(), std::ios::binary);
+		if (!file)
+		{
+			return false;
+		}
+		data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return !file.bad();
+	}
+} //namespace
+
+uint64_t CalculateJobHash(const Settings& settings, uint64_t geometryHash)
+{
+	// performance and output routing options (queue, contexts, shards, simulate) do not change images,
+	// mirrors are applied differently with slice cache
+	std::stringstream s;
+	s << std::setprecision(9) << ManifestVersion << " " << settings.whiteLayers << " " <<
+		settings.doOverhangAnalysis << " " << settings.maxSupportedDistance << " " << settings.enableERM << " " <<
+		settings.mirrorX << " " << settings.mirrorY << " " << settings.cacheDir.empty();
+
+	Hasher hasher;
+	hasher.Update(&geometryHash, sizeof(geometryHash));
+	hasher.Update(s.str());
+	return hasher.Finish();
+}
+
+SliceManifest::SliceManifest(const std::string& outputDir, const std::string& manifestName, uint64_t jobHash)
+{
+	const auto dir = boost::filesystem::path(outputDir);
+	const auto manifestPath = dir / manifestName;
+	const auto header = "job " + FormatHash(jobHash);
+
+	std::ifstream previous(manifestPath.string());
+	std::string line;
+	if (previous && std::getline(previous, line) && line == header)
+	{
+		std::vector<char> data;
+		while (std::getline(previous, line))
+		{
+			// last line may be cut by crash
+			std::istringstream entry(line);
+			std::string fileName;
+			std::string hash;
+			if (!(entry >> fileName >> hash) || hash.size() != 16)
+			{
+				continue;
+			}
+			if (ReadFile(dir / fileName, data) && FormatHash(Hash64(data.data(), data.size())) == hash)
+			{
+				completed_[fileName] = std::stoull(hash, nullptr, 16);
+			}
+			else
+			{
+				completed_.erase(fileName);
+			}
+		}
+	}
+	previous.close();
+
+	std::stringstream compacted;
+	compacted << header << "\n";
+	for (const auto& entry : completed_)
+	{
+		compacted << entry.first << " " << FormatHash(entry.second) << "\n";
+	}
+	const auto content = compacted.str();
+	WriteFileAtomically(manifestPath.string(), content.data(), content.size());
+
+	file_.open(manifestPath.string(), std::ios::app);
+	CHECK_EX(file_, "Can't open slice manifest");
+
+	if (!completed_.empty())
+	{
+		BOOST_LOG_TRIVIAL(info) << "Files completed by previous run: " << completed_.size();
+	}
+}
+
+bool SliceManifest::IsComplete(const std::string& fileName) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return completed_.count(fileName) != 0;
+}
+
+size_t SliceManifest::GetCompletedCount() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return completed_.size();
+}
+
+void SliceManifest::Record(const std::string& filePath, uint64_t contentHash)
+{
+	const auto fileName = boost::filesystem::path(filePath).filename().string();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	completed_[fileName] = contentHash;
+	// flushed per file, entry of lost line is only rendered again
+	file_ << fileName << " " << FormatHash(contentHash) << std::endl;
+	CHECK_EX(file_, "Can't write slice manifest");
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct Settings;
+
+// Hash of settings which affect output files or their numbering, geometryHash covers model and rendering settings.
+uint64_t CalculateJobHash(const Settings& settings, uint64_t geometryHash);
+
+// Records slice files completed in output directory, so interrupted job can be resumed.
+// Text file: "job <hash>" header, then "<file name> <content hash>" line per written file.
+class SliceManifest
+{
+public:
+	// Keeps entries of previous run with same job hash if their files still have recorded content,
+	// other entries are dropped from manifest.
+	SliceManifest(const std::string& outputDir, const std::string& manifestName, uint64_t jobHash);
+
+	bool IsComplete(const std::string& fileName) const;
+	size_t GetCompletedCount() const;
+	// called after file is written, thread-safe
+	void Record(const std::string& filePath, uint64_t contentHash);
+
+private:
+	mutable std::mutex mutex_;
+	std::unordered_map<std::string, uint64_t> completed_;
+	std::ofstream file_;
+};
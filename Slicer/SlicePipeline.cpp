@@ -0,0 +1,510 @@
+#include "SlicePipeline.h"
+#include "Utils.h"
+
+#include <PngFile.h>
+#include <PngEncoder.h>
+#include <LayerStack.h>
+#include <Raster.h>
+#include <Hash.h>
+#include <ErrorHandling.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/log/trivial.hpp>
+
+namespace
+{
+	// several encoders finish identical frames out of order
+	const size_t RecentEncodedCount = 8;
+
+	double ToSeconds(std::chrono::steady_clock::duration duration)
+	{
+		return std::chrono::duration_cast<std::chrono::duration<double>>(duration).count();
+	}
+} //namespace
+
+void SlicePipeline::StageStats::Merge(const StageStats& other)
+{
+	items += other.items;
+	busy += other.busy;
+	starved += other.starved;
+	blocked += other.blocked;
+}
+
+SlicePipeline::SlicePipeline(uint32_t width, uint32_t height, const std::vector<uint32_t>& palette, bool lowBitDepth, bool simulate,
+	size_t encodeThreads, size_t queueCapacity, size_t producers) :
+	width_(width),
+	height_(height),
+	palette_(palette),
+	lowBitDepth_(lowBitDepth),
+	simulate_(simulate),
+	producers_(std::max<size_t>(1, producers)),
+	mirrorX_(false),
+	mirrorY_(false),
+	encodeQueue_(queueCapacity),
+	writeQueue_(queueCapacity),
+	runningEncoders_(std::max<size_t>(1, encodeThreads)),
+	stopped_(false),
+	reusedEncodes_(0),
+	startTime_(Clock::now()),
+	nextWrite_(0)
+{
+	const size_t cores = std::thread::hardware_concurrency();
+	if (cores > runningEncoders_)
+	{
+		const auto bandThreads = cores - runningEncoders_;
+		bandPool_ = std::make_unique<WorkerPool>(bandThreads, bandThreads * runningEncoders_);
+	}
+	for (size_t i = 0; i < runningEncoders_; ++i)
+	{
+		encodeThreads_.emplace_back([this]() { EncodeLoop(); });
+	}
+	writeThread_ = std::thread([this]() { WriteLoop(); });
+}
+
+SlicePipeline::~SlicePipeline()
+{
+	Stop();
+}
+
+void SlicePipeline::Push(uint64_t sequence, const std::string& fileName, FrameBuffer frame)
+{
+	Slice slice;
+	slice.sequence = sequence;
+	slice.fileName = fileName;
+	slice.frame = std::move(frame);
+	PushSlice(std::move(slice));
+}
+
+void SlicePipeline::Push(uint64_t sequence, const std::string& fileName, FrameBuffer frame, uint64_t cacheKey)
+{
+	Slice slice;
+	slice.sequence = sequence;
+	slice.fileName = fileName;
+	slice.frame = std::move(frame);
+	slice.cacheable = true;
+	slice.cacheKey = cacheKey;
+	PushSlice(std::move(slice));
+}
+
+void SlicePipeline::PushCached(uint64_t sequence, const std::string& fileName, std::vector<uint8_t> png)
+{
+	Slice slice;
+	slice.sequence = sequence;
+	slice.fileName = fileName;
+	slice.png = std::move(png);
+	PushSlice(std::move(slice));
+}
+
+void SlicePipeline::PushSlice(Slice slice)
+{
+	RethrowFailure();
+
+	const auto pushTime = Clock::now();
+	CHECK_EX(encodeQueue_.Push(std::move(slice)), "Slice pipeline is stopped");
+	const auto blocked = Clock::now() - pushTime;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	renderStats_.blocked += blocked;
+	++renderStats_.items;
+}
+
+void SlicePipeline::Finish()
+{
+	if (stopped_)
+	{
+		return;
+	}
+	Stop();
+
+	// GL threads are either rendering or waiting for encode queue
+	const auto wallTime = Clock::now() - startTime_;
+	renderStats_.busy = std::max(wallTime * static_cast<int>(producers_) - renderStats_.blocked, Clock::duration::zero());
+	LogStats("render", renderStats_, producers_, wallTime);
+	LogStats("encode", encodeStats_, encodeThreads_.size(), wallTime);
+	LogStats("write", writeStats_, 1, wallTime);
+	BOOST_LOG_TRIVIAL(info) << "Encodes avoided for identical slices: " << reusedEncodes_;
+	if (fileWriter_)
+	{
+		try
+		{
+			fileWriter_->Finish();
+		}
+		catch (...)
+		{
+			SetFailure(std::current_exception());
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (failure_)
+	{
+		auto error = failure_;
+		failure_ = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+void SlicePipeline::Stop()
+{
+	if (stopped_)
+	{
+		return;
+	}
+	stopped_ = true;
+
+	encodeQueue_.Close();
+	for (auto& t : encodeThreads_)
+	{
+		t.join();
+	}
+	writeThread_.join();
+}
+
+void SlicePipeline::SetWrittenHandler(const WrittenHandler& handler)
+{
+	writtenHandler_ = handler;
+}
+
+void SlicePipeline::SetArchive(const std::shared_ptr<ZipWriter>& archive)
+{
+	archive_ = archive;
+}
+
+void SlicePipeline::SetLayerStack(const std::shared_ptr<LayerStackWriter>& layerStack)
+{
+	layerStack_ = layerStack;
+}
+
+void SlicePipeline::SetFileWriter(const std::shared_ptr<AsyncFileWriter>& fileWriter)
+{
+	fileWriter_ = fileWriter;
+}
+
+void SlicePipeline::SetOutputHandler(const OutputHandler& handler)
+{
+	outputHandler_ = handler;
+}
+
+void SlicePipeline::SetCache(const std::shared_ptr<SliceCache>& cache, bool mirrorX, bool mirrorY)
+{
+	cache_ = cache;
+	mirrorX_ = mirrorX;
+	mirrorY_ = mirrorY;
+}
+
+void SlicePipeline::EncodeLoop()
+{
+	StageStats stats;
+	// decoded cached image
+	std::vector<uint8_t> pixels;
+	auto waitStart = Clock::now();
+	Slice slice;
+	while (encodeQueue_.Pop(slice))
+	{
+		const auto workStart = Clock::now();
+		stats.starved += workStart - waitStart;
+
+		// after failure queued slices are only drained
+		if (!simulate_ && !HasFailed())
+		{
+			try
+			{
+				Encode(slice, pixels);
+			}
+			catch (...)
+			{
+				SetFailure(std::current_exception());
+			}
+		}
+		slice.frame.Release();
+
+		const auto workEnd = Clock::now();
+		stats.busy += workEnd - workStart;
+		writeQueue_.Push(std::move(slice));
+		waitStart = Clock::now();
+		stats.blocked += waitStart - workEnd;
+		++stats.items;
+	}
+	stats.starved += Clock::now() - waitStart;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	encodeStats_.Merge(stats);
+	if (--runningEncoders_ == 0)
+	{
+		writeQueue_.Close();
+	}
+}
+
+void SlicePipeline::Encode(Slice& slice, std::vector<uint8_t>& pixels)
+{
+	const auto width = static_cast<int>(width_);
+	const auto height = static_cast<int>(height_);
+	// output differs from cached PNG of unmirrored frame
+	const auto transform = mirrorX_ || mirrorY_ || layerStack_;
+
+	if (!slice.frame.IsValid())
+	{
+		if (transform)
+		{
+			uint32_t cachedWidth = 0;
+			uint32_t cachedHeight = 0;
+			DecodePng(slice.png, cachedWidth, cachedHeight, pixels);
+			CHECK_EX(cachedWidth == width_ && cachedHeight == height_, "Cached slice has wrong size");
+			MirrorRaster(pixels.data(), width, height, mirrorX_, mirrorY_);
+			EncodeFrame(slice.png, pixels.data(), pixels.size());
+		}
+		return;
+	}
+
+	// identical frames (empty or prismatic layers) reuse image encoded earlier
+	const auto frameHash = Hash64(slice.frame.GetData(), slice.frame.GetSize());
+	if (FindEncoded(frameHash, slice, pixels))
+	{
+		return;
+	}
+	// noise-like frame isn't kept for comparison, its RLE would be larger than frame
+	auto frame = std::make_shared<std::vector<uint8_t>>();
+	EncodeRleLayer(slice.frame.GetData(), width_, height_, *frame);
+	if (frame->size() > slice.frame.GetSize())
+	{
+		frame.reset();
+	}
+
+	std::vector<uint8_t> cachePng;
+	if (cache_ && slice.cacheable)
+	{
+		EncodePngFrame(cachePng, slice.frame.GetData(), slice.frame.GetSize());
+		cache_->Store(slice.cacheKey, cachePng);
+		if (!transform)
+		{
+			slice.png = std::move(cachePng);
+			RememberEncoded(frameHash, frame, slice.png, std::vector<uint8_t>());
+			return;
+		}
+	}
+
+	MirrorRaster(slice.frame.GetData(), width, height, mirrorX_, mirrorY_);
+	EncodeFrame(slice.png, slice.frame.GetData(), slice.frame.GetSize());
+	RememberEncoded(frameHash, frame, slice.png, cachePng);
+}
+
+void SlicePipeline::EncodeFrame(std::vector<uint8_t>& encoded, const uint8_t* pixData, size_t pixDataSize) const
+{
+	if (layerStack_)
+	{
+		EncodeRleLayer(pixData, width_, height_, encoded);
+	}
+	else
+	{
+		EncodePngFrame(encoded, pixData, pixDataSize);
+	}
+}
+
+void SlicePipeline::EncodePngFrame(std::vector<uint8_t>& png, const uint8_t* pixData, size_t pixDataSize) const
+{
+	if (lowBitDepth_)
+	{
+		EncodePackedPng(png, width_, height_, pixData, pixDataSize, palette_, bandPool_.get());
+	}
+	else
+	{
+		const auto BitsPerChannel = 8;
+		EncodeBandedPng(png, width_, height_, BitsPerChannel, pixData, pixDataSize, palette_, bandPool_.get());
+	}
+}
+
+bool SlicePipeline::FindEncoded(uint64_t frameHash, Slice& slice, std::vector<uint8_t>& pixels)
+{
+	std::shared_ptr<const std::vector<uint8_t>> frame;
+	{
+		std::lock_guard<std::mutex> lock(encodedMutex_);
+		const auto it = std::find_if(recentEncoded_.begin(), recentEncoded_.end(),
+			[frameHash](const EncodedFrame& encoded) { return encoded.frameHash == frameHash; });
+		if (it == recentEncoded_.end())
+		{
+			return false;
+		}
+		frame = it->frame;
+	}
+
+	// equal hashes of different frames must not share image, frames are compared outside of lock
+	DecodeRleLayer(frame->data(), frame->size(), width_, height_, pixels);
+	if (pixels.size() > slice.frame.GetSize() || memcmp(pixels.data(), slice.frame.GetData(), pixels.size()) != 0)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(encodedMutex_);
+	// entry may have been evicted meanwhile
+	const auto it = std::find_if(recentEncoded_.begin(), recentEncoded_.end(),
+		[&frame](const EncodedFrame& encoded) { return encoded.frame == frame; });
+	if (it == recentEncoded_.end())
+	{
+		return false;
+	}
+
+	slice.png = it->encoded;
+	// without transform output is cached PNG, entry of uncached slice has no PNG for cache otherwise
+	const auto transform = mirrorX_ || mirrorY_ || layerStack_;
+	if (cache_ && slice.cacheable && (!transform || !it->cachePng.empty()))
+	{
+		cache_->Store(slice.cacheKey, transform ? it->cachePng : it->encoded);
+	}
+	recentEncoded_.splice(recentEncoded_.begin(), recentEncoded_, it);
+	++reusedEncodes_;
+	return true;
+}
+
+void SlicePipeline::RememberEncoded(uint64_t frameHash, const std::shared_ptr<const std::vector<uint8_t>>& frame,
+	const std::vector<uint8_t>& encoded, const std::vector<uint8_t>& cachePng)
+{
+	if (!frame)
+	{
+		return;
+	}
+
+	EncodedFrame entry;
+	entry.frameHash = frameHash;
+	entry.frame = frame;
+	entry.encoded = encoded;
+	entry.cachePng = cachePng;
+
+	std::lock_guard<std::mutex> lock(encodedMutex_);
+	recentEncoded_.push_front(std::move(entry));
+	if (recentEncoded_.size() > RecentEncodedCount)
+	{
+		recentEncoded_.pop_back();
+	}
+}
+
+void SlicePipeline::WriteLoop()
+{
+	StageStats stats;
+	auto waitStart = Clock::now();
+	Slice slice;
+	while (writeQueue_.Pop(slice))
+	{
+		const auto workStart = Clock::now();
+		stats.starved += workStart - waitStart;
+
+		if (slice.sequence != nextWrite_)
+		{
+			const auto sequence = slice.sequence;
+			outOfOrder_[sequence] = std::move(slice);
+			waitStart = Clock::now();
+			continue;
+		}
+
+		WriteSlice(slice);
+		++stats.items;
+		++nextWrite_;
+		for (auto it = outOfOrder_.find(nextWrite_); it != outOfOrder_.end(); it = outOfOrder_.find(nextWrite_))
+		{
+			WriteSlice(it->second);
+			outOfOrder_.erase(it);
+			++stats.items;
+			++nextWrite_;
+		}
+
+		waitStart = Clock::now();
+		stats.busy += waitStart - workStart;
+	}
+	stats.starved += Clock::now() - waitStart;
+
+	// gaps are left by producers which failed
+	for (auto& pending : outOfOrder_)
+	{
+		WriteSlice(pending.second);
+		++stats.items;
+	}
+	outOfOrder_.clear();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	writeStats_.Merge(stats);
+}
+
+void SlicePipeline::WriteSlice(Slice& slice)
+{
+	if (simulate_ || HasFailed())
+	{
+		return;
+	}
+
+	try
+	{
+		if (outputHandler_)
+		{
+			outputHandler_(slice.sequence, slice.fileName, slice.png);
+		}
+		else if (layerStack_)
+		{
+			layerStack_->Add(slice.png);
+		}
+		else if (archive_)
+		{
+			archive_->Add(boost::filesystem::path(slice.fileName).filename().string(), slice.png.data(), slice.png.size());
+		}
+		else if (fileWriter_)
+		{
+			// written handler is called by I/O thread once file is complete
+			fileWriter_->Write(slice.fileName, std::move(slice.png), writtenHandler_);
+			return;
+		}
+		else
+		{
+			WriteFileAtomically(slice.fileName, slice.png.data(), slice.png.size());
+		}
+		if (writtenHandler_)
+		{
+			writtenHandler_(slice.fileName, slice.png);
+		}
+	}
+	catch (...)
+	{
+		SetFailure(std::current_exception());
+	}
+}
+
+void SlicePipeline::SetFailure(std::exception_ptr error)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!failure_)
+	{
+		failure_ = error;
+	}
+}
+
+bool SlicePipeline::HasFailed()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return failure_ != nullptr;
+}
+
+void SlicePipeline::RethrowFailure()
+{
+	std::exception_ptr error;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		error = failure_;
+	}
+	if (error)
+	{
+		std::rethrow_exception(error);
+	}
+}
+
+void SlicePipeline::LogStats(const char* name, const StageStats& stats, size_t threads, Clock::duration wallTime) const
+{
+	const auto available = ToSeconds(wallTime) * threads;
+	std::stringstream s;
+	s << std::fixed << std::setprecision(2) << "Stage " << name << ": " << stats.items << " slices, busy " <<
+		ToSeconds(stats.busy) << " s (" << std::setprecision(0) << (available > 0 ? 100.0 * ToSeconds(stats.busy) / available : 0.0) <<
+		"%)" << std::setprecision(2) << ", waiting for input " << ToSeconds(stats.starved) <<
+		" s, stalled on output " << ToSeconds(stats.blocked) << " s";
+	BOOST_LOG_TRIVIAL(info) << s.str();
+}
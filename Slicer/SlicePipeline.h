@@ -0,0 +1,154 @@
+#pragma once
+
+#include <BoundedQueue.h>
+#include <FramePool.h>
+#include <ZipWriter.h>
+#include <LayerStack.h>
+#include <AsyncFileWriter.h>
+#include <WorkerPool.h>
+
+#include "SliceCache.h"
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Slice output stages after GL thread: render & readback -> PNG encode (worker threads) -> file write (single thread).
+// Stages are connected by bounded queues, so GL threads only stall when encoders fall behind.
+// Several GL threads may push concurrently, writer restores slice order.
+class SlicePipeline
+{
+public:
+	// lowBitDepth writes slices with few gray levels as 1, 2 or 4-bit PNG
+	SlicePipeline(uint32_t width, uint32_t height, const std::vector<uint32_t>& palette, bool lowBitDepth, bool simulate,
+		size_t encodeThreads, size_t queueCapacity, size_t producers = 1);
+	// drops failures, call Finish to observe them
+	~SlicePipeline();
+
+	// Called by GL threads, blocks while encode queue is full. Rethrows failure of earlier slice.
+	// Sequence numbers start from 0 without gaps, files are passed to output in sequence order.
+	void Push(uint64_t sequence, const std::string& fileName, FrameBuffer frame);
+	// unmirrored frame is also stored in slice cache under cacheKey
+	void Push(uint64_t sequence, const std::string& fileName, FrameBuffer frame, uint64_t cacheKey);
+	// unmirrored PNG loaded from slice cache
+	void PushCached(uint64_t sequence, const std::string& fileName, std::vector<uint8_t> png);
+	// Waits for queued slices, logs stage statistics, rethrows first failure.
+	void Finish();
+
+	// Called after file is completely written, set before first Push. With file writer it's called concurrently
+	// by I/O threads in completion order, so handler must be thread-safe.
+	using WrittenHandler = std::function<void(const std::string& fileName, const std::vector<uint8_t>& png)>;
+	void SetWrittenHandler(const WrittenHandler& handler);
+	// slices are added to archive under file name without directory instead of writing files, set before first Push
+	void SetArchive(const std::shared_ptr<ZipWriter>& archive);
+	// slices are RLE encoded and appended to layer stack instead of writing PNG files, set before first Push
+	void SetLayerStack(const std::shared_ptr<LayerStackWriter>& layerStack);
+	// slice files are written by I/O threads of writer with several files in flight, set before first Push
+	void SetFileWriter(const std::shared_ptr<AsyncFileWriter>& fileWriter);
+	// encoded slices are passed to handler on writer thread in sequence order instead of being written,
+	// set before first Push
+	using OutputHandler = std::function<void(uint64_t sequence, const std::string& fileName, const std::vector<uint8_t>& png)>;
+	void SetOutputHandler(const OutputHandler& handler);
+	// With cache frames are pushed unmirrored, mirrors are applied on encoding. Set before first Push.
+	void SetCache(const std::shared_ptr<SliceCache>& cache, bool mirrorX, bool mirrorY);
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	struct Slice
+	{
+		uint64_t sequence = 0;
+		std::string fileName;
+		FrameBuffer frame;
+		bool cacheable = false;
+		uint64_t cacheKey = 0;
+		// cached PNG, then encoded output (PNG or layer stack layer)
+		std::vector<uint8_t> png;
+	};
+
+	struct EncodedFrame
+	{
+		uint64_t frameHash = 0;
+		// RLE of unmirrored frame, compared before encoded image is reused
+		std::shared_ptr<const std::vector<uint8_t>> frame;
+		std::vector<uint8_t> encoded;
+		// PNG of unmirrored frame for slice cache if it differs from output
+		std::vector<uint8_t> cachePng;
+	};
+
+	struct StageStats
+	{
+		void Merge(const StageStats& other);
+
+		uint64_t items = 0;
+		Clock::duration busy = Clock::duration::zero();
+		// waiting for input
+		Clock::duration starved = Clock::duration::zero();
+		// waiting for space in output queue
+		Clock::duration blocked = Clock::duration::zero();
+	};
+
+	void PushSlice(Slice slice);
+	void EncodeLoop();
+	void Encode(Slice& slice, std::vector<uint8_t>& pixels);
+	void EncodeFrame(std::vector<uint8_t>& encoded, const uint8_t* pixData, size_t pixDataSize) const;
+	void EncodePngFrame(std::vector<uint8_t>& png, const uint8_t* pixData, size_t pixDataSize) const;
+	bool FindEncoded(uint64_t frameHash, Slice& slice, std::vector<uint8_t>& pixels);
+	void RememberEncoded(uint64_t frameHash, const std::shared_ptr<const std::vector<uint8_t>>& frame,
+		const std::vector<uint8_t>& encoded, const std::vector<uint8_t>& cachePng);
+	void WriteLoop();
+	void WriteSlice(Slice& slice);
+	void Stop();
+	void SetFailure(std::exception_ptr error);
+	bool HasFailed();
+	void RethrowFailure();
+	void LogStats(const char* name, const StageStats& stats, size_t threads, Clock::duration wallTime) const;
+
+	const uint32_t width_;
+	const uint32_t height_;
+	const std::vector<uint32_t> palette_;
+	const bool lowBitDepth_;
+	const bool simulate_;
+	const size_t producers_;
+	// cores left by encoder threads deflate bands of single image, null if there are none
+	std::unique_ptr<WorkerPool> bandPool_;
+	WrittenHandler writtenHandler_;
+	OutputHandler outputHandler_;
+	std::shared_ptr<SliceCache> cache_;
+	std::shared_ptr<ZipWriter> archive_;
+	std::shared_ptr<LayerStackWriter> layerStack_;
+	std::shared_ptr<AsyncFileWriter> fileWriter_;
+	bool mirrorX_;
+	bool mirrorY_;
+
+	BoundedQueue<Slice> encodeQueue_;
+	BoundedQueue<Slice> writeQueue_;
+	std::vector<std::thread> encodeThreads_;
+	std::thread writeThread_;
+
+	std::mutex mutex_;
+	std::exception_ptr failure_;
+	size_t runningEncoders_;
+	bool stopped_;
+
+	// most recently encoded frames first
+	std::mutex encodedMutex_;
+	std::list<EncodedFrame> recentEncoded_;
+	uint64_t reusedEncodes_;
+
+	Clock::time_point startTime_;
+	// written by WriteLoop only
+	std::map<uint64_t, Slice> outOfOrder_;
+	uint64_t nextWrite_;
+	StageStats renderStats_;
+	StageStats encodeStats_;
+	StageStats writeStats_;
+};
@@ -0,0 +1,446 @@
+// winsock2 has to be included before windows.h
+#include <boost/asio.hpp>
+
+#include "SliceServer.h"
+
+#include <ErrorHandling.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <boost/log/trivial.hpp>
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+	using Socket = boost::asio::ip::tcp::socket;
+
+	double ToMilliseconds(Clock::duration duration)
+	{
+		return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(duration).count();
+	}
+
+	bool IsPng(const std::vector<uint8_t>& data)
+	{
+		const uint8_t Signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		return data.size() >= sizeof(Signature) && std::equal(std::begin(Signature), std::end(Signature), data.begin());
+	}
+
+	std::string ReadLine(Socket& socket, boost::asio::streambuf& input)
+	{
+		boost::asio::read_until(socket, input, '\n');
+		std::istream stream(&input);
+		std::string line;
+		std::getline(stream, line);
+		return line;
+	}
+} //namespace
+
+struct SliceServer::Network
+{
+	Network(uint16_t port) :
+		acceptor(io, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port))
+	{
+	}
+
+	boost::asio::io_context io;
+	boost::asio::ip::tcp::acceptor acceptor;
+	std::thread acceptThread;
+	// guarded by server mutex
+	std::list<std::shared_ptr<Connection>> connections;
+};
+
+struct SliceServer::Connection
+{
+	Connection(boost::asio::io_context& io) : socket(io), finished(false)
+	{
+	}
+
+	Socket socket;
+	std::thread thread;
+	// set under server mutex when Serve returned, thread only exits after it
+	bool finished;
+};
+
+SliceServer::SliceServer(uint16_t port, const ServerLayout& layout, std::vector<uint8_t> basePng, uint64_t cacheBytes,
+	uint32_t prefetchLayers) :
+	layout_(layout),
+	basePng_(std::make_shared<const std::vector<uint8_t>>(std::move(basePng))),
+	cacheBytes_(cacheBytes),
+	prefetchLayers_(prefetchLayers),
+	stopped_(false),
+	nextLayer_(0),
+	cachedBytes_(0),
+	network_(std::make_unique<Network>(port))
+{
+	CHECK_EX(layout_.imagesPerSlice > 0, "Invalid server layout");
+}
+
+SliceServer::~SliceServer()
+{
+}
+
+uint32_t SliceServer::GetLayerCount() const
+{
+	return layout_.baseLayers + layout_.slices * layout_.imagesPerSlice;
+}
+
+uint32_t SliceServer::GetSlice(uint32_t layer) const
+{
+	return (layer - layout_.baseLayers) / layout_.imagesPerSlice;
+}
+
+void SliceServer::AddLayer(uint32_t layer, std::vector<uint8_t> png)
+{
+	auto frame = std::make_shared<const std::vector<uint8_t>>(std::move(png));
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	// images of slice are output in order
+	if ((layer - layout_.baseLayers) % layout_.imagesPerSlice == layout_.imagesPerSlice - 1)
+	{
+		rendering_.erase(GetSlice(layer));
+	}
+
+	const auto existing = frames_.find(layer);
+	if (existing != frames_.end())
+	{
+		cachedBytes_ -= existing->second.png->size();
+		recency_.erase(existing->second.recency);
+		frames_.erase(existing);
+	}
+	recency_.push_front(layer);
+	cachedBytes_ += frame->size();
+	frames_[layer] = CacheEntry{ std::move(frame), recency_.begin() };
+
+	// last requested layer and prefetched ones after it are kept, so prefetch can't evict what it prepared
+	for (auto i = recency_.end(); cachedBytes_ > cacheBytes_ && i != recency_.begin();)
+	{
+		--i;
+		if (*i + 1 >= nextLayer_ && *i < nextLayer_ + prefetchLayers_)
+		{
+			continue;
+		}
+		const auto entry = frames_.find(*i);
+		cachedBytes_ -= entry->second.png->size();
+		frames_.erase(entry);
+		i = recency_.erase(i);
+	}
+
+	changed_.notify_all();
+}
+
+// requested layers first, then layers ahead of requester
+bool SliceServer::FindSliceToRender(uint32_t& slice) const
+{
+	const auto isMissing = [this](uint32_t layer) {
+		return layer >= layout_.baseLayers && !frames_.count(layer) && !rendering_.count(GetSlice(layer));
+	};
+
+	for (auto layer : requested_)
+	{
+		if (isMissing(layer))
+		{
+			slice = GetSlice(layer);
+			return true;
+		}
+	}
+
+	const auto end = std::min(GetLayerCount(), nextLayer_ + prefetchLayers_);
+	for (auto layer = nextLayer_; layer < end; ++layer)
+	{
+		if (isMissing(layer))
+		{
+			slice = GetSlice(layer);
+			return true;
+		}
+	}
+	return false;
+}
+
+SliceServer::Frame SliceServer::GetLayer(uint32_t layer)
+{
+	if (layer < layout_.baseLayers)
+	{
+		return basePng_;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	nextLayer_ = layer + 1;
+	changed_.notify_all();
+	for (;;)
+	{
+		if (failure_)
+		{
+			throw std::runtime_error("Rendering failed");
+		}
+		if (stopped_)
+		{
+			throw std::runtime_error("Server is stopping");
+		}
+
+		const auto entry = frames_.find(layer);
+		if (entry != frames_.end())
+		{
+			requested_.erase(layer);
+			recency_.splice(recency_.begin(), recency_, entry->second.recency);
+			return entry->second.png;
+		}
+		// also after eviction by other requester
+		if (requested_.insert(layer).second)
+		{
+			changed_.notify_all();
+		}
+		changed_.wait(lock);
+	}
+}
+
+void SliceServer::Run(const RenderHandler& render)
+{
+	network_->acceptThread = std::thread(&SliceServer::AcceptLoop, this);
+	std::cout << "Serving " << GetLayerCount() << " layers on " << network_->acceptor.local_endpoint() << "\n";
+
+	try
+	{
+		for (;;)
+		{
+			uint32_t slice = 0;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				changed_.wait(lock, [&]() { return stopped_ || FindSliceToRender(slice); });
+				if (stopped_)
+				{
+					break;
+				}
+				rendering_.insert(slice);
+			}
+			render(slice);
+		}
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		failure_ = std::current_exception();
+	}
+
+	Stop();
+	Shutdown();
+	if (failure_)
+	{
+		std::rethrow_exception(failure_);
+	}
+}
+
+void SliceServer::Stop()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	stopped_ = true;
+	changed_.notify_all();
+}
+
+void SliceServer::Shutdown()
+{
+	// blocking accept is woken by connection to itself
+	{
+		boost::system::error_code error;
+		Socket wake(network_->io);
+		wake.connect(network_->acceptor.local_endpoint(), error);
+	}
+	network_->acceptThread.join();
+
+	// wakes connections waiting for next request
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (const auto& connection : network_->connections)
+		{
+			boost::system::error_code error;
+			connection->socket.shutdown(Socket::shutdown_both, error);
+		}
+	}
+	for (const auto& connection : network_->connections)
+	{
+		connection->thread.join();
+	}
+}
+
+void SliceServer::AcceptLoop()
+{
+	for (;;)
+	{
+		auto connection = std::make_shared<Connection>(network_->io);
+		boost::system::error_code error;
+		network_->acceptor.accept(connection->socket, error);
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (stopped_)
+		{
+			return;
+		}
+		if (error)
+		{
+			BOOST_LOG_TRIVIAL(warning) << "Can't accept connection: " << error.message();
+			continue;
+		}
+
+		// clients reconnect during long running server, so closed connections are released
+		auto& connections = network_->connections;
+		for (auto i = connections.begin(); i != connections.end();)
+		{
+			if ((*i)->finished)
+			{
+				(*i)->thread.join();
+				i = connections.erase(i);
+			}
+			else
+			{
+				++i;
+			}
+		}
+
+		connection->thread = std::thread([this, connection]() {
+			Serve(connection);
+			std::lock_guard<std::mutex> lock(mutex_);
+			connection->finished = true;
+		});
+		connections.push_back(connection);
+	}
+}
+
+void SliceServer::Serve(const std::shared_ptr<Connection>& connection)
+{
+	auto& socket = connection->socket;
+	boost::asio::streambuf input;
+	for (auto stop = false; !stop;)
+	{
+		boost::system::error_code error;
+		boost::asio::read_until(socket, input, '\n', error);
+		if (error)
+		{
+			return;
+		}
+		std::istream stream(&input);
+		std::string line;
+		std::getline(stream, line);
+
+		const auto start = Clock::now();
+		std::istringstream request(line);
+		std::string command;
+		request >> command;
+		std::string response;
+		Frame png;
+		try
+		{
+			if (command == "INFO")
+			{
+				response = "OK " + std::to_string(GetLayerCount()) + " " + std::to_string(layout_.width) + " " +
+					std::to_string(layout_.height) + " " + std::to_string(layout_.baseLayers);
+			}
+			else if (command == "LAYER")
+			{
+				uint32_t layer = 0;
+				if (!(request >> layer) || layer >= GetLayerCount())
+				{
+					throw std::runtime_error("Layer is out of range");
+				}
+				png = GetLayer(layer);
+				response = "OK " + std::to_string(layer) + " " + std::to_string(png->size());
+			}
+			else if (command == "STOP")
+			{
+				response = "OK";
+				stop = true;
+			}
+			else
+			{
+				throw std::runtime_error("Unknown request: " + command);
+			}
+		}
+		catch (const std::exception& e)
+		{
+			response = std::string("ERR ") + e.what();
+		}
+		response += "\n";
+
+		std::vector<boost::asio::const_buffer> buffers{ boost::asio::buffer(response) };
+		if (png)
+		{
+			buffers.push_back(boost::asio::buffer(*png));
+		}
+		boost::asio::write(socket, buffers, error);
+		if (error)
+		{
+			return;
+		}
+		BOOST_LOG_TRIVIAL(info) << line << ": " << ToMilliseconds(Clock::now() - start) << " ms";
+	}
+	Stop();
+}
+
+bool QueryServer(uint16_t port)
+{
+	boost::asio::io_context io;
+	Socket socket(io);
+	socket.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+	boost::asio::streambuf input;
+	const auto request = [&](const std::string& line) {
+		boost::asio::write(socket, boost::asio::buffer(line + "\n"));
+		return ReadLine(socket, input);
+	};
+
+	const auto info = request("INFO");
+	std::istringstream infoResponse(info);
+	std::string status;
+	uint32_t layers = 0;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t baseLayers = 0;
+	if (!(infoResponse >> status >> layers >> width >> height >> baseLayers) || status != "OK")
+	{
+		std::cout << "INFO failed: " << info << "\n";
+		return false;
+	}
+
+	const auto start = Clock::now();
+	Clock::duration first = Clock::duration::zero();
+	Clock::duration slowest = Clock::duration::zero();
+	std::vector<uint8_t> png;
+	for (uint32_t layer = 0; layer < layers; ++layer)
+	{
+		const auto requestStart = Clock::now();
+		const auto header = request("LAYER " + std::to_string(layer));
+		std::istringstream response(header);
+		uint32_t responseLayer = 0;
+		size_t size = 0;
+		if (!(response >> status >> responseLayer >> size) || status != "OK" || responseLayer != layer)
+		{
+			std::cout << "Layer " << layer << " failed: " << header << "\n";
+			return false;
+		}
+
+		// beginning of image may be buffered with header
+		png.resize(size);
+		const auto buffered = std::min(size, input.size());
+		boost::asio::buffer_copy(boost::asio::buffer(png), input.data(), buffered);
+		input.consume(buffered);
+		boost::asio::read(socket, boost::asio::buffer(png.data() + buffered, size - buffered));
+		if (!IsPng(png))
+		{
+			std::cout << "Layer " << layer << " is not PNG image\n";
+			return false;
+		}
+
+		const auto time = Clock::now() - requestStart;
+		// base layers are ready before any slice is rendered
+		first = layer == baseLayers ? time : first;
+		slowest = std::max(slowest, time);
+	}
+
+	const auto total = Clock::now() - start;
+	std::cout << std::fixed << std::setprecision(2) << "Layers: " << layers << ", first slice " << ToMilliseconds(first) <<
+		" ms, average " << (layers > 0 ? ToMilliseconds(total) / layers : 0.0) << " ms, slowest " <<
+		ToMilliseconds(slowest) << " ms\n";
+	return true;
+}
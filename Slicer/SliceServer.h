@@ -0,0 +1,95 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Layers of job in output order: base layers, then images of each slice.
+struct ServerLayout
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t baseLayers = 0;
+	uint32_t slices = 0;
+	uint32_t imagesPerSlice = 1;
+};
+
+// Serves encoded layers of one job on demand, so printer controller doesn't wait for whole job to be sliced.
+// Clients on loopback TCP port send request lines:
+//   INFO        -> "OK <layers> <width> <height> <base layers>"
+//   LAYER <n>   -> "OK <n> <size>" followed by size bytes of PNG
+//   STOP        -> "OK", server stops
+// failed request is answered with "ERR <message>".
+// Layers following last requested one are prefetched, encoded layers are kept in size bounded LRU cache.
+class SliceServer
+{
+public:
+	// renders slice and outputs its images through AddLayer
+	using RenderHandler = std::function<void(uint32_t slice)>;
+
+	SliceServer(uint16_t port, const ServerLayout& layout, std::vector<uint8_t> basePng, uint64_t cacheBytes,
+		uint32_t prefetchLayers);
+	~SliceServer();
+
+	// Thread-safe, called for each image of rendered slice.
+	void AddLayer(uint32_t layer, std::vector<uint8_t> png);
+	// Renders slices on calling thread until STOP request, rethrows failure of render.
+	void Run(const RenderHandler& render);
+
+private:
+	using Frame = std::shared_ptr<const std::vector<uint8_t>>;
+	// socket types stay in translation unit, so winsock headers don't meet windows.h of includer
+	struct Network;
+	struct Connection;
+
+	struct CacheEntry
+	{
+		Frame png;
+		std::list<uint32_t>::iterator recency;
+	};
+
+	uint32_t GetLayerCount() const;
+	uint32_t GetSlice(uint32_t layer) const;
+	bool FindSliceToRender(uint32_t& slice) const;
+	Frame GetLayer(uint32_t layer);
+	void AcceptLoop();
+	void Serve(const std::shared_ptr<Connection>& connection);
+	void Stop();
+	void Shutdown();
+
+	const ServerLayout layout_;
+	const Frame basePng_;
+	const uint64_t cacheBytes_;
+	const uint32_t prefetchLayers_;
+
+	std::mutex mutex_;
+	// signals requested layers, added layers and stop to render loop and waiting requests
+	std::condition_variable changed_;
+	bool stopped_;
+	std::exception_ptr failure_;
+	// requested layers which are not cached yet
+	std::set<uint32_t> requested_;
+	// slices between render and AddLayer of their last image
+	std::set<uint32_t> rendering_;
+	// prefetch starts after last requested layer
+	uint32_t nextLayer_;
+
+	// most recently used first
+	std::list<uint32_t> recency_;
+	std::unordered_map<uint32_t, CacheEntry> frames_;
+	uint64_t cachedBytes_;
+
+	std::unique_ptr<Network> network_;
+};
+
+// Requests all layers from server on local port in order like printer controller, checks each is PNG image and
+// prints time to first slice layer and average layer time. Returns false on failed request.
+bool QueryServer(uint16_t port);
@@ -1,20 +1,35 @@
 #include "Renderer.h"
 #include "ERM.h"
 #include "Utils.h"
+#include "ShardCoordinator.h"
+#include "SliceManifest.h"
+#include "ContourExport.h"
+#include "SliceServer.h"
 
 #include <PngFile.h>
-#include <Raster.h>
+#include <PngEncoder.h>
+#include <RunRaster.h>
 #include <PerfTimer.h>
 #include <ErrorHandling.h>
+#include <Hash.h>
+#include <ZipWriter.h>
+#include <LayerStack.h>
 
 #include <memory>
+#include <mutex>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <iomanip>
 #include <string>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <numeric>
+#include <set>
 #include <thread>
+#include <utility>
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
@@ -24,10 +39,18 @@
 
 #include <psapi.h>
 
-void WriteWhiteLayers(const Settings& settings, const std::pair<glm::vec2, glm::vec2>& bounds)
+const char* const ManifestName = "slices.manifest";
+
+// single file outputs replacing files in output directory, null if not used
+struct JobOutput
 {
-	const auto outputDir = boost::filesystem::path(settings.outputDir);
+	std::shared_ptr<ZipWriter> archive;
+	std::shared_ptr<LayerStackWriter> layerStack;
+};
 
+// basement rectangle around model projection
+std::vector<uint8_t> CreateBasementLayer(const Settings& settings, const std::pair<glm::vec2, glm::vec2>& bounds)
+{
 	const auto xBorder = settings.basementBorder * settings.renderWidth / settings.plateWidth;
 	const auto yBorder = settings.basementBorder * settings.renderHeight / settings.plateHeight;
 
@@ -36,60 +59,639 @@ void WriteWhiteLayers(const Settings& settings, const std::pair<glm::vec2, glm::
 	const int xEnd = std::min(static_cast<int>(settings.renderWidth), static_cast<int>(bounds.second.x + xBorder));
 	const int yEnd = std::min(static_cast<int>(settings.renderHeight), static_cast<int>(bounds.second.y + yBorder));
 
-	std::vector<uint8_t> data(settings.renderWidth * settings.renderHeight, 0);
-	ForEachPixel(std::make_pair(xStart, xEnd), std::make_pair(yStart, yEnd), [&data, &settings](auto x, auto y) {
-		const uint8_t WhiteColorPaletteIndex = 0xFF;
-		data[y * settings.renderWidth + x] = WhiteColorPaletteIndex;
-	});
+	RunRaster basement(static_cast<int>(settings.renderWidth), static_cast<int>(settings.renderHeight));
+	for (auto y = yStart; y < yEnd; ++y)
+	{
+		basement.AppendRun(y, xStart, xEnd);
+	}
+
+	const uint8_t WhiteColorPaletteIndex = 0xFF;
+	std::vector<uint8_t> data;
+	basement.ToBytes(data, WhiteColorPaletteIndex);
+	return data;
+}
+
+std::vector<uint8_t> EncodeLayerPng(const Settings& settings, const std::vector<uint8_t>& data)
+{
+	// single image per job, encoded on calling thread
+	std::vector<uint8_t> png;
+	if (settings.lowBitDepth)
+	{
+		EncodePackedPng(png, settings.renderWidth, settings.renderHeight, data.data(), data.size(), CreateGrayscalePalette());
+	}
+	else
+	{
+		EncodeBandedPng(png, settings.renderWidth, settings.renderHeight, 8, data.data(), data.size(), CreateGrayscalePalette());
+	}
+	return png;
+}
+
+void WriteWhiteLayers(const Settings& settings, const std::pair<glm::vec2, glm::vec2>& bounds, const JobOutput& output)
+{
+	const auto outputDir = boost::filesystem::path(settings.outputDir);
+	const auto data = CreateBasementLayer(settings, bounds);
+
+	if (output.layerStack)
+	{
+		std::vector<uint8_t> layer;
+		EncodeRleLayer(data.data(), settings.renderWidth, settings.renderHeight, layer);
+		for (uint32_t i = 0; i < settings.whiteLayers; ++i)
+		{
+			output.layerStack->Add(layer);
+		}
+		return;
+	}
 
-	const auto palette = CreateGrayscalePalette();
+	const auto png = EncodeLayerPng(settings, data);
 	for (uint32_t i = 0; i < settings.whiteLayers; ++i)
 	{
-		const auto filePath = (outputDir / GetOutputFileName(settings, i)).string();
-		WritePng(filePath, settings.renderWidth, settings.renderHeight, 8, data, palette);
+		if (output.archive)
+		{
+			output.archive->Add(GetOutputFileName(settings, i), png.data(), png.size());
+		}
+		else
+		{
+			const auto filePath = (outputDir / GetOutputFileName(settings, i)).string();
+			WriteFileAtomically(filePath, png.data(), png.size());
+		}
 	}	
 }
 
+uint32_t GetImagesPerSlice(const Settings& settings)
+{
+	return settings.enableERM ? 2 : 1;
+}
+
+uint32_t GetImageNumber(const Settings& settings, uint32_t slice)
+{
+	return settings.whiteLayers + slice * GetImagesPerSlice(settings);
+}
+
+// slices of range without all images recorded in manifest
+std::vector<uint32_t> GetPendingSlices(const Renderer& r, const Settings& settings, const SliceRange& range,
+	const SliceManifest* manifest)
+{
+	std::vector<uint32_t> slices;
+	const auto end = std::min(range.end, r.GetSliceCount());
+	for (auto slice = range.first; slice < end; ++slice)
+	{
+		auto complete = manifest != nullptr;
+		for (uint32_t i = 0; complete && i < GetImagesPerSlice(settings); ++i)
+		{
+			complete = manifest->IsComplete(GetOutputFileName(settings, GetImageNumber(settings, slice) + i));
+		}
+		if (!complete)
+		{
+			slices.push_back(slice);
+		}
+	}
+	return slices;
+}
+
+// Outputs black images for empty slice, images from slice cache if all of them are there, renders slice otherwise.
+void RenderSlice(Renderer& r, const Settings& settings, uint32_t slice)
+{
+	const auto outputDir = boost::filesystem::path(settings.outputDir);
+	const auto imageNumber = GetImageNumber(settings, slice);
+	auto cache = r.GetSliceCache();
+
+	// overhang analysis accumulates every rendered slice
+	if (!settings.doOverhangAnalysis && r.IsSliceEmpty(slice))
+	{
+		for (uint32_t i = 0; i < GetImagesPerSlice(settings); ++i)
+		{
+			r.SaveEmptyPng((outputDir / GetOutputFileName(settings, imageNumber + i)).string());
+		}
+		return;
+	}
+
+	if (cache)
+	{
+		std::vector<std::vector<uint8_t>> cached(GetImagesPerSlice(settings));
+		auto hit = true;
+		for (uint32_t i = 0; hit && i < cached.size(); ++i)
+		{
+			hit = cache->Load(cache->GetKey(slice, i), cached[i]);
+		}
+		if (hit)
+		{
+			for (uint32_t i = 0; i < cached.size(); ++i)
+			{
+				r.SaveCachedPng((outputDir / GetOutputFileName(settings, imageNumber + i)).string(), std::move(cached[i]));
+			}
+			return;
+		}
+	}
+
+	const auto getKey = [cache, slice](uint32_t image) { return cache ? cache->GetKey(slice, image) : 0; };
+
+	r.GoToSlice(slice);
+	r.SavePng((outputDir / GetOutputFileName(settings, imageNumber)).string(), getKey(0));
+
+	if (settings.doOverhangAnalysis)
+	{
+		r.AnalyzeOverhangs(imageNumber);
+	}
+
+	if (settings.enableERM)
+	{
+		r.ERM();
+		r.SavePng((outputDir / GetOutputFileName(settings, imageNumber + 1)).string(), getKey(1));
+	}
+}
+
+uint32_t RenderSlices(Renderer& r, const Settings& settings, const std::vector<uint32_t>& slices)
+{
+	uint32_t nSlice = 0;
+	for (auto slice : slices)
+	{
+		RenderSlice(r, settings, slice);
+		++nSlice;
+	}
+	return nSlice;
+}
+
+// Context i renders slices[i], slices[i + contexts], ... on its own thread, pipeline restores output order.
+// Overhang analysis needs previous slice in same context, so it is not supported here.
+uint32_t RenderSlicesParallel(Renderer& primary, const Settings& settings, const std::vector<uint32_t>& slices)
+{
+	ASSERT(!settings.doOverhangAnalysis);
+	const auto imagesPerSlice = GetImagesPerSlice(settings);
+
+	std::vector<std::unique_ptr<Renderer>> secondary;
+	for (uint32_t i = 1; i < settings.contexts; ++i)
+	{
+		secondary.push_back(std::make_unique<Renderer>(settings, primary));
+	}
+	std::vector<Renderer*> renderers{ &primary };
+	for (const auto& r : secondary)
+	{
+		renderers.push_back(r.get());
+	}
+	for (auto r : renderers)
+	{
+		r->ReleaseCurrent();
+	}
+
+	const auto contexts = renderers.size();
+	std::vector<uint32_t> rendered(contexts, 0);
+	std::vector<std::exception_ptr> errors(contexts);
+	std::atomic<bool> failed(false);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < contexts; ++i)
+	{
+		threads.emplace_back([&, i]() {
+			auto& r = *renderers[i];
+			try
+			{
+				r.MakeCurrent();
+				for (auto index = i; !failed && index < slices.size(); index += contexts)
+				{
+					r.SetOutputSequence(static_cast<uint64_t>(index) * imagesPerSlice);
+					RenderSlice(r, settings, slices[index]);
+					++rendered[i];
+				}
+			}
+			catch (...)
+			{
+				errors[i] = std::current_exception();
+				failed = true;
+			}
+			r.ReleaseCurrent();
+		});
+	}
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+
+	secondary.clear();
+	primary.MakeCurrent();
+	for (const auto& error : errors)
+	{
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
+	}
+	return std::accumulate(rendered.begin(), rendered.end(), 0u);
+}
+
+uint32_t RenderRange(Renderer& r, const Settings& settings, const SliceRange& range, const std::string& manifestName)
+{
+	std::unique_ptr<SliceManifest> manifest;
+	if (!settings.simulate && settings.archive.empty() && settings.layerStack.empty())
+	{
+		manifest = std::make_unique<SliceManifest>(settings.outputDir, manifestName, CalculateJobHash(settings, r.GetGeometryHash()));
+		auto& m = *manifest;
+		r.SetPngWrittenHandler([&m](const std::string& fileName, const std::vector<uint8_t>& png) {
+			m.Record(fileName, Hash64(png.data(), png.size()));
+		});
+	}
+
+	// overhang analysis accumulates all previous slices, so they can't be skipped
+	const auto resume = settings.resume && !settings.doOverhangAnalysis;
+	const auto slices = GetPendingSlices(r, settings, range, resume ? manifest.get() : nullptr);
+	const auto end = std::min(range.end, r.GetSliceCount());
+	if (end > range.first && slices.size() < end - range.first)
+	{
+		BOOST_LOG_TRIVIAL(info) << "Resuming job, slices left: " << slices.size() << " of " << end - range.first;
+	}
+
+	const auto nSlice = settings.contexts > 1 ? RenderSlicesParallel(r, settings, slices) : RenderSlices(r, settings, slices);
+	r.WaitForPendingWrites();
+	r.SetPngWrittenHandler(nullptr);
+	return nSlice;
+}
+
+void PrepareOutput(Renderer& r, const Settings& settings, const JobOutput& output = JobOutput())
+{
+	if (settings.simulate)
+	{
+		return;
+	}
+	if (!output.archive && !output.layerStack)
+	{
+		boost::filesystem::create_directories(settings.outputDir);
+	}
+	WriteWhiteLayers(settings, r.GetModelProjectionRect(), output);
+}
+
+void WriteJobConfig(const Settings& settings, uint32_t nSlice, const JobOutput& output = JobOutput())
+{
+	BOOST_LOG_TRIVIAL(info) << "Total slices: " << nSlice;
+
+	// config refers to PNG files, which are not written with layer stack
+	if (settings.simulate || settings.envisiontechTemplatesPath.empty() || output.layerStack)
+	{
+		return;
+	}
+	if (output.archive)
+	{
+		const auto config = GenerateEnvisiontechConfig(settings, nSlice);
+		output.archive->Add("job.cfg", config.data(), config.size());
+	}
+	else
+	{
+		WriteEnvisiontechConfig(settings, "job.cfg", nSlice);
+	}
+}
+
 void RenderModel(Renderer& r, const Settings& settings)
 {
 	PerfTimer renderTime("Render time");
-	const auto outputDir = boost::filesystem::path(settings.outputDir);
-	
+
+	// slices are streamed into archive or layer stack in layer order after white layers,
+	// job config is last entry of archive
+	JobOutput output;
+	if (!settings.simulate && !settings.layerStack.empty())
+	{
+		LayerStackHeader header;
+		header.width = settings.renderWidth;
+		header.height = settings.renderHeight;
+		header.step = settings.step;
+		header.plateWidth = settings.plateWidth;
+		header.plateHeight = settings.plateHeight;
+		header.baseLayers = settings.whiteLayers;
+		header.imagesPerSlice = GetImagesPerSlice(settings);
+		header.keyframeInterval = settings.keyframeInterval;
+		output.layerStack = std::make_shared<LayerStackWriter>(settings.layerStack, header);
+		r.SetLayerStack(output.layerStack);
+	}
+	else if (!settings.simulate && !settings.archive.empty())
+	{
+		output.archive = std::make_shared<ZipWriter>(settings.archive);
+		r.SetArchive(output.archive);
+	}
+
+	PrepareOutput(r, settings, output);
+	RenderRange(r, settings, SliceRange(), ManifestName);
+	WriteJobConfig(settings, r.GetSliceCount(), output);
+	if (output.archive)
+	{
+		output.archive->Finish();
+	}
+	if (output.layerStack)
+	{
+		output.layerStack->Finish();
+	}
+}
+
+// Decodes every layer of layer stack and compares it with PNG output of same job in output directory.
+bool VerifyLayerStack(const Settings& settings)
+{
+	PerfTimer verifyTime("Verify layer stack");
+	LayerStackReader stack(settings.layerStack);
+	const auto& header = stack.GetHeader();
+
+	uint32_t mismatches = 0;
+	std::vector<uint8_t> layer;
+	std::vector<uint8_t> expected;
+	// sequential playback, each delta is applied to previous layer
+	for (uint32_t i = 0; stack.ReadNext(layer); ++i)
+	{
+		const auto fileName = GetOutputFileName(settings, i);
+		std::ifstream file((boost::filesystem::path(settings.outputDir) / fileName).string(), std::ios::binary);
+		const std::vector<uint8_t> png((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		uint32_t width = 0;
+		uint32_t height = 0;
+		if (!file || png.empty())
+		{
+			BOOST_LOG_TRIVIAL(error) << "Can't read " << fileName;
+			++mismatches;
+			continue;
+		}
+		DecodePng(png, width, height, expected);
+		if (width != header.width || height != header.height || layer != expected)
+		{
+			BOOST_LOG_TRIVIAL(error) << "Layer " << i << " differs from " << fileName;
+			++mismatches;
+		}
+	}
+
+	std::cout << "Layer stack layers: " << stack.GetLayerCount() << ", mismatches: " << mismatches << "\n";
+	return mismatches == 0;
+}
+
+// Coordinator renders first shard itself while worker processes render the others into same output directory
+// with global image numbers, so gathered output is identical to single process run.
+void CoordinateShards(Renderer& r, const Settings& settings, int argc, char** argv)
+{
+	PerfTimer renderTime("Render time");
+	PrepareOutput(r, settings);
+
+	const auto ranges = SplitSlices(r.GetLayersCount(), settings.shards);
+	auto launcher = settings.shardLauncher.empty() ?
+		CreateLocalShardLauncher() : CreateCommandShardLauncher(settings.shardLauncher);
+	for (uint32_t shard = 1; shard < ranges.size(); ++shard)
+	{
+		launcher->Start(shard, BuildShardCommandLine(argc, argv, shard));
+	}
+
+	RenderRange(r, settings, ranges[0], ManifestName);
+	launcher->Wait();
+	WriteJobConfig(settings, r.GetSliceCount());
+}
+
+void RenderShard(Renderer& r, const Settings& settings)
+{
+	PerfTimer renderTime("Shard render time");
+	const auto ranges = SplitSlices(r.GetLayersCount(), settings.shards);
+	CHECK_EX(static_cast<uint32_t>(settings.shard) < ranges.size(), "Shard index is out of range");
 	if (!settings.simulate)
 	{
 		boost::filesystem::create_directories(settings.outputDir);
-		WriteWhiteLayers(settings, r.GetModelProjectionRect());
 	}
-	
-	uint32_t nSlice = 0;
-	uint32_t imageNumber = settings.whiteLayers;
-	r.FirstSlice();
-	do
+
+	const auto manifestName = "slices.shard" + std::to_string(settings.shard) + ".manifest";
+	const auto nSlice = RenderRange(r, settings, ranges[settings.shard], manifestName);
+	BOOST_LOG_TRIVIAL(info) << "Shard " << settings.shard << " slices: " << nSlice;
+}
+
+// Renders layers requested by clients of slice server until STOP request.
+void ServeModel(Renderer& r, const Settings& settings)
+{
+	CHECK_EX(settings.serverPort <= 0xFFFF, "Server port is out of range");
+
+	ServerLayout layout;
+	layout.width = settings.renderWidth;
+	layout.height = settings.renderHeight;
+	layout.baseLayers = settings.whiteLayers;
+	layout.slices = r.GetSliceCount();
+	layout.imagesPerSlice = GetImagesPerSlice(settings);
+
+	SliceServer server(static_cast<uint16_t>(settings.serverPort), layout,
+		EncodeLayerPng(settings, CreateBasementLayer(settings, r.GetModelProjectionRect())),
+		uint64_t(settings.serverCacheSize) * 1024 * 1024, settings.prefetch * layout.imagesPerSlice);
+	// each rendered slice outputs its images with consecutive sequence numbers, in order of rendering
+	std::mutex renderedMutex;
+	std::vector<uint32_t> rendered;
+	r.SetOutputSequence(0);
+	r.SetPngOutputHandler([&](uint64_t sequence, const std::string&, const std::vector<uint8_t>& png) {
+		uint32_t slice = 0;
+		{
+			std::lock_guard<std::mutex> lock(renderedMutex);
+			slice = rendered[sequence / layout.imagesPerSlice];
+		}
+		server.AddLayer(GetImageNumber(settings, slice) + static_cast<uint32_t>(sequence % layout.imagesPerSlice), png);
+	});
+
+	try
 	{
-		auto filePath = (outputDir / GetOutputFileName(settings, imageNumber++)).string();
-		r.SavePng(filePath);
-	
-		if (settings.doOverhangAnalysis)
+		server.Run([&](uint32_t slice) {
+			{
+				std::lock_guard<std::mutex> lock(renderedMutex);
+				rendered.push_back(slice);
+			}
+			RenderSlice(r, settings, slice);
+		});
+	}
+	catch (...)
+	{
+		// pipeline outputs into server until it is finished
+		try
 		{
-			r.AnalyzeOverhangs(imageNumber-1);
+			r.WaitForPendingWrites();
 		}
+		catch (...)
+		{
+		}
+		throw;
+	}
+	r.WaitForPendingWrites();
+}
 
-		if (settings.enableERM)
+struct BatchJob
+{
+	std::string modelFile;
+	// empty if job uses command line and base config only
+	std::string configFile;
+};
+
+// Line is model file optionally followed by config file, paths with spaces are quoted. Empty lines and lines
+// starting with # are skipped.
+std::vector<BatchJob> ReadJobList(const std::string& fileName)
+{
+	std::ifstream file(fileName);
+	CHECK_EX(file, "Can't open job list");
+
+	std::vector<BatchJob> jobs;
+	std::string line;
+	while (std::getline(file, line))
+	{
+		std::istringstream s(line);
+		BatchJob job;
+		if (!(s >> std::quoted(job.modelFile)) || job.modelFile[0] == '#')
 		{
-			r.ERM();
-			filePath = (outputDir / GetOutputFileName(settings, imageNumber++)).string();
-			r.SavePng(filePath);
+			continue;
 		}
+		s >> std::quoted(job.configFile);
+		jobs.push_back(job);
+	}
+	return jobs;
+}
 
-		++nSlice;
-	} while (r.NextSlice());
+// Appends suffix to file or directory name before extension: "out/slices.zip" -> "out/slices_part.zip"
+std::string AppendToStem(const std::string& path, const std::string& suffix)
+{
+	auto p = boost::filesystem::path(path);
+	// directory given with trailing separator
+	if (p.filename() == ".")
+	{
+		p = p.parent_path();
+	}
+	return (p.parent_path() / (p.stem().string() + "_" + suffix + p.extension().string())).string();
+}
 
-	BOOST_LOG_TRIVIAL(info) << "Total slices: " << nSlice;
+// Renders jobs with one renderer, so GL context, programs and render targets are created once and only re-created
+// when resolution changes. Failed job is reported and batch continues. Returns number of failed jobs.
+uint32_t RenderBatch(const std::vector<BatchJob>& jobs, const std::function<Settings(const BatchJob&)>& getJobSettings)
+{
+	using Clock = std::chrono::steady_clock;
+	const auto batchStart = Clock::now();
 
-	if (!settings.simulate && !settings.envisiontechTemplatesPath.empty())
+	std::unique_ptr<Renderer> r;
+	Settings rendererSettings;
+	uint32_t failed = 0;
+	for (size_t i = 0; i < jobs.size(); ++i)
 	{
-		WriteEnvisiontechConfig(settings, "job.cfg", nSlice);
+		const auto jobStart = Clock::now();
+		std::string error;
+		uint32_t slices = 0;
+		try
+		{
+			auto settings = getJobSettings(jobs[i]);
+			if (settings.contexts > 1 || settings.shards > 1 || settings.shard >= 0)
+			{
+				BOOST_LOG_TRIVIAL(warning) << "Batch jobs are rendered by single context of this process";
+				settings.contexts = 1;
+				settings.shards = 1;
+				settings.shard = -1;
+			}
+
+			if (!settings.contours.empty())
+			{
+				slices = ExportContours(settings);
+			}
+			if (settings.raster)
+			{
+				// warm context can't change window mode or samples
+				if (r && (settings.offscreen != rendererSettings.offscreen || settings.samples != rendererSettings.samples))
+				{
+					r.reset();
+				}
+				if (r)
+				{
+					r->StartJob(settings);
+				}
+				else
+				{
+					r = std::make_unique<Renderer>(settings);
+					rendererSettings = settings;
+				}
+				RenderModel(*r, settings);
+				slices = r->GetSliceCount();
+			}
+		}
+		catch (const std::exception& e)
+		{
+			error = e.what();
+			++failed;
+		}
+
+		const auto seconds = std::chrono::duration<double>(Clock::now() - jobStart).count();
+		std::cout << "Job " << i + 1 << "/" << jobs.size() << " " << jobs[i].modelFile << ": " <<
+			std::fixed << std::setprecision(2) << seconds << " s, ";
+		if (error.empty())
+		{
+			std::cout << slices << " slices\n";
+		}
+		else
+		{
+			std::cout << "failed: " << error << "\n";
+		}
+	}
+
+	const auto seconds = std::chrono::duration<double>(Clock::now() - batchStart).count();
+	std::cout << "Batch: " << jobs.size() << " jobs, " << failed << " failed, " <<
+		std::fixed << std::setprecision(2) << seconds << " s\n";
+	return failed;
+}
+
+SyncPolicy ParseSyncPolicy(const std::string& sync)
+{
+	if (sync == "each")
+	{
+		return SyncPolicy::EachFile;
+	}
+	if (sync == "finish")
+	{
+		return SyncPolicy::AtFinish;
+	}
+	if (sync != "none")
+	{
+		throw std::runtime_error("Unknown sync policy: " + sync);
 	}
+	return SyncPolicy::None;
+}
+
+// resolves options which can't be used together
+void AdjustSettings(Settings& settings)
+{
+	if (settings.serverPort > 0)
+	{
+		if (settings.doOverhangAnalysis)
+		{
+			BOOST_LOG_TRIVIAL(warning) << "Overhang analysis needs sequential slicing, it is disabled for slice server";
+			settings.doOverhangAnalysis = false;
+		}
+		// layers are passed to server, nothing is written
+		settings.simulate = false;
+		settings.writeThreads = 0;
+		settings.contexts = 1;
+		settings.shards = 1;
+		settings.shard = -1;
+	}
+	settings.contexts = std::max(1u, settings.contexts);
+	if (settings.contexts > 1 && settings.doOverhangAnalysis)
+	{
+		BOOST_LOG_TRIVIAL(warning) << "Overhang analysis needs sequential slicing, using single rendering context";
+		settings.contexts = 1;
+	}
+	settings.shards = std::max(1u, settings.shards);
+	if (settings.shards > 1 && settings.doOverhangAnalysis)
+	{
+		BOOST_LOG_TRIVIAL(warning) << "Overhang analysis needs sequential slicing, using single shard";
+		settings.shards = 1;
+	}
+	if (!settings.layerStack.empty() && !settings.archive.empty())
+	{
+		BOOST_LOG_TRIVIAL(warning) << "Layer stack replaces archive output, archive is not written";
+		settings.archive.clear();
+	}
+	if (!settings.layerStack.empty() && settings.doOverhangAnalysis)
+	{
+		BOOST_LOG_TRIVIAL(warning) << "Overhang images can't be stored in layer stack, overhang analysis is disabled";
+		settings.doOverhangAnalysis = false;
+	}
+	if ((!settings.archive.empty() || !settings.layerStack.empty()) && (settings.shards > 1 || settings.shard >= 0))
+	{
+		BOOST_LOG_TRIVIAL(warning) << "Archive or layer stack is written by single process, using single shard";
+		settings.shards = 1;
+		settings.shard = -1;
+	}
+	if (!settings.cacheDir.empty() && settings.doOverhangAnalysis)
+	{
+		BOOST_LOG_TRIVIAL(warning) << "Overhang analysis needs every slice rendered, slice cache is disabled";
+		settings.cacheDir.clear();
+	}
+}
+
+void LogPeakWorkingSet()
+{
+	PROCESS_MEMORY_COUNTERS pmc{};
+	GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+	BOOST_LOG_TRIVIAL(info) << "Peak working set: " << pmc.PeakWorkingSetSize / 1024 / 1024 << " MB";
 }
 
 int main(int argc, char** argv)
@@ -98,7 +700,11 @@ int main(int argc, char** argv)
 	{
 		Settings settings;
 		bool verbose = false;
+		bool verifyLayerStack = false;
+		std::string sync = "none";
 		std::string configFile;
+		std::string batch;
+		uint32_t queryServer = 0;
 
 		namespace po = boost::program_options;
 		// Declare a group of options that will be 
@@ -107,6 +713,8 @@ int main(int argc, char** argv)
 		generic.add_options()
 			("help,h", "produce help message")
 			("config,c", po::value<std::string>(&configFile), "slicing configuration file")
+			("queryServer", po::value<uint32_t>(&queryServer), "request all layers from slice server on this local port, print layer times and exit")
+			("batch", po::value<std::string>(&batch), "slice jobs of this list in one process, line is model file and optional job config file (outputs it doesn't set are named after model)")
 			;
 
 		// Declare a group of options that will be 
@@ -139,6 +747,23 @@ int main(int argc, char** argv)
 			("enableERM,e", po::value<bool>(&settings.enableERM)->default_value(settings.enableERM), "enable ERM mode")
 			("envisiontechTemplatesPath", po::value<std::string>(&settings.envisiontechTemplatesPath)->default_value(settings.envisiontechTemplatesPath), "envisiontech job templates path")
 
+			("contexts", po::value<uint32_t>(&settings.contexts)->default_value(settings.contexts), "rendering contexts, each renders slices on own thread")
+			("resume", po::value<bool>(&settings.resume)->default_value(settings.resume), "skip slices completed by interrupted run of same job")
+			("shards", po::value<uint32_t>(&settings.shards)->default_value(settings.shards), "worker processes splitting slices by height")
+			("shard", po::value<int32_t>(&settings.shard)->default_value(settings.shard), "render only this shard (set by coordinator for workers)")
+			("shardLauncher", po::value<std::string>(&settings.shardLauncher)->default_value(settings.shardLauncher), "shard worker launch command, e.g. \"ssh node{shard} {command}\" (local processes if empty)")
+			("archive", po::value<std::string>(&settings.archive)->default_value(settings.archive), "write slices and job config into this ZIP file instead of output directory")
+			("layerStack", po::value<std::string>(&settings.layerStack)->default_value(settings.layerStack), "write all layers RLE encoded into this layer stack file instead of PNG files")
+			("keyframeInterval", po::value<uint32_t>(&settings.keyframeInterval)->default_value(settings.keyframeInterval), "layer stack stores every Nth layer in full and others as delta to previous layer")
+			("contours", po::value<std::string>(&settings.contours)->default_value(settings.contours), "write slice contours from mesh into this CLI file (.cli) or SVG directory")
+			("raster", po::value<bool>(&settings.raster)->default_value(settings.raster), "render slice images (false with contours writes vectors only)")
+			("serverPort", po::value<uint32_t>(&settings.serverPort)->default_value(settings.serverPort), "serve layers on demand on this loopback port instead of writing job (0 writes job)")
+			("prefetch", po::value<uint32_t>(&settings.prefetch)->default_value(settings.prefetch), "slices rendered by server ahead of last requested layer")
+			("serverCacheSize", po::value<uint32_t>(&settings.serverCacheSize)->default_value(settings.serverCacheSize), "server memory cache of encoded layers (MB)")
+			("cacheDir", po::value<std::string>(&settings.cacheDir)->default_value(settings.cacheDir), "slice cache directory shared by jobs (disabled if empty)")
+			("cacheSize", po::value<uint32_t>(&settings.cacheSize)->default_value(settings.cacheSize), "slice cache size limit (MB)")
+			("writeThreads", po::value<uint32_t>(&settings.writeThreads)->default_value(settings.writeThreads), "slice files written concurrently (0 writes them one by one)")
+			("sync", po::value<std::string>(&sync)->default_value(sync), "flush slice files to disk: none, each (before file is recorded) or finish (all at end of job)")
 			("queue", po::value<uint32_t>(&settings.queue)->default_value(settings.queue), "PNG compression & write queue length (balance CPU-GPU load)")
 			("whiteLayers", po::value<uint32_t>(&settings.whiteLayers)->default_value(settings.whiteLayers), "white layers count")
 			("basementBorder", po::value<float>(&settings.basementBorder)->default_value(settings.basementBorder), "basement border size (mm)")
@@ -146,8 +771,11 @@ int main(int argc, char** argv)
 			("mirrorX", po::value<bool>(&settings.mirrorX)->default_value(settings.mirrorX), "mirror image horizontally")
 			("mirrorY", po::value<bool>(&settings.mirrorY)->default_value(settings.mirrorY), "mirror image vertically")
 
+			("lowBitDepth", po::value<bool>(&settings.lowBitDepth)->default_value(settings.lowBitDepth), "write 1, 2 or 4-bit PNG for slices with up to 16 gray levels")
+
 			("simulate", po::value<bool>(&settings.simulate)->default_value(settings.simulate), "do not save files")
 			("verbose", po::value<bool>(&verbose)->default_value(verbose), "print extended information")
+			("verifyLayerStack", po::value<bool>(&verifyLayerStack)->default_value(verifyLayerStack), "compare layerStack with PNG output of same job in outputDir and exit")
 			;
 
 		po::options_description cmdline_options;
@@ -172,8 +800,21 @@ int main(int argc, char** argv)
             po::store(po::parse_config_file<char>(configFile.c_str(), config_file_options), vm);
             po::notify(vm);
         }
-		
-		if (settings.modelFile.empty())
+
+		settings.sync = ParseSyncPolicy(sync);
+
+		if (queryServer > 0)
+		{
+			CHECK_EX(queryServer <= 0xFFFF, "Server port is out of range");
+			return QueryServer(static_cast<uint16_t>(queryServer)) ? 0 : 1;
+		}
+
+		if (verifyLayerStack)
+		{
+			return VerifyLayerStack(settings) ? 0 : 1;
+		}
+
+		if (settings.modelFile.empty() && batch.empty())
 		{
 			std::cout << "No model to slice, exit" << "\n";
 			return 0;
@@ -187,12 +828,89 @@ int main(int argc, char** argv)
 			);
 		}
 
+		if (!batch.empty())
+		{
+			// job config overrides command line, which overrides base config
+			const auto batchOutputDir = settings.outputDir;
+			const auto failed = RenderBatch(ReadJobList(batch), [&](const BatchJob& job) {
+				po::variables_map jobVm;
+				std::set<std::string> jobKeys;
+				if (!job.configFile.empty())
+				{
+					const auto jobOptions = po::parse_config_file<char>(job.configFile.c_str(), config_file_options);
+					for (const auto& option : jobOptions.options)
+					{
+						jobKeys.insert(option.string_key);
+					}
+					po::store(jobOptions, jobVm);
+				}
+				po::store(po::parse_command_line(argc, argv, cmdline_options), jobVm);
+				if (!configFile.empty())
+				{
+					po::store(po::parse_config_file<char>(configFile.c_str(), config_file_options), jobVm);
+				}
+				po::notify(jobVm);
+
+				settings.modelFile = job.modelFile;
+				const auto modelName = boost::filesystem::path(job.modelFile).stem().string();
+				// jobs without own outputs write into subdirectory or files named after model, so they don't
+				// overwrite each other
+				if (!jobKeys.count("outputDir"))
+				{
+					settings.outputDir = (boost::filesystem::path(batchOutputDir) / modelName).string();
+				}
+				for (const auto& output : { std::make_pair("archive", &settings.archive),
+					std::make_pair("layerStack", &settings.layerStack), std::make_pair("contours", &settings.contours) })
+				{
+					if (!output.second->empty() && !jobKeys.count(output.first))
+					{
+						*output.second = AppendToStem(*output.second, modelName);
+					}
+				}
+				if (settings.serverPort > 0)
+				{
+					BOOST_LOG_TRIVIAL(warning) << "Slice server is not supported in batch mode, serverPort is ignored";
+					settings.serverPort = 0;
+				}
+				settings.sync = ParseSyncPolicy(sync);
+				AdjustSettings(settings);
+				return settings;
+			});
+			LogPeakWorkingSet();
+			return failed == 0 ? 0 : 1;
+		}
+
+		AdjustSettings(settings);
+
+		// shard workers only render images
+		if (!settings.contours.empty() && settings.shard < 0)
+		{
+			ExportContours(settings);
+		}
+		if (!settings.raster)
+		{
+			return 0;
+		}
+
 		Renderer r(settings);
-		RenderModel(r, settings);
+		if (settings.serverPort > 0)
+		{
+			ServeModel(r, settings);
+		}
+		else if (settings.shard >= 0)
+		{
+			RenderShard(r, settings);
+		}
+		else if (settings.shards > 1)
+		{
+			CoordinateShards(r, settings, argc, argv);
+		}
+		else
+		{
+			RenderModel(r, settings);
+		}
 
-		PROCESS_MEMORY_COUNTERS pmc{};
-		GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
-		BOOST_LOG_TRIVIAL(info) << "Peak working set: " << pmc.PeakWorkingSetSize / 1024 / 1024 << " MB";
+		LogPeakWorkingSet();
 	}
 	catch (const std::exception& e)
 	{
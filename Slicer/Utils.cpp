@@ -1,16 +1,31 @@
 #include "Utils.h"
 
-const auto SliceFileDigits = 5;
+#include <ErrorHandling.h>
 
-std::string ReplaceAll(const std::string & str, const std::string & what, const std::string & to)
-{
-	std::regex rx(what);
-	return std::regex_replace(str, rx, to);
-}
+#include <fstream>
+
+#include <boost/filesystem.hpp>
+
+const auto SliceFileDigits = 5;
 
 std::string GetOutputFileName(const Settings & settings, uint32_t slice)
 {
 	std::stringstream s;
 	s << std::setfill('0') << std::setw(SliceFileDigits) << slice << ".png";
 	return s.str();
-}
\ No newline at end of file
+}
+
+void WriteFileAtomically(const std::string& fileName, const void* data, size_t size)
+{
+	// unique name, so processes sharing directory (slice cache) don't write or remove each other's temporary file
+	const auto tempFileName = boost::filesystem::unique_path(fileName + ".%%%%-%%%%-%%%%.tmp").string();
+	{
+		std::ofstream file(tempFileName, std::ios::binary | std::ios::trunc);
+		CHECK_EX(file, "Can't create file");
+		file.write(static_cast<const char*>(data), size);
+		file.close();
+		CHECK_EX(file, "Can't write file");
+	}
+	// replaces existing file
+	boost::filesystem::rename(tempFileName, fileName);
+}
@@ -1,11 +1,11 @@
 #pragma once
 #include <string>
 #include <cstdint>
-#include <regex>
 #include <sstream>
 #include <iomanip>
 
 struct Settings;
 
-std::string ReplaceAll(const std::string& str, const std::string& what, const std::string& to);
-std::string GetOutputFileName(const Settings& settings, uint32_t slice);
\ No newline at end of file
+std::string GetOutputFileName(const Settings& settings, uint32_t slice);
+// Writes to uniquely named temporary file (fileName.<random>.tmp) and renames it, so fileName never has partial content.
+void WriteFileAtomically(const std::string& fileName, const void* data, size_t size);
\ No newline at end of file